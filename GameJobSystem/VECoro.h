@@ -20,7 +20,18 @@
 #include <algorithm>
 #include <assert.h>
 #include <memory_resource>
-
+#include <memory>
+#include <utility>
+
+#if !defined(_MSC_VER)      //GCC and Clang have the C++20 header, MSVC uses its experimental one
+    #include <coroutine>
+    namespace std::experimental {
+        using std::coroutine_handle;
+        using std::suspend_always;
+        using std::suspend_never;
+        using std::noop_coroutine;
+    }
+#endif
 
 namespace vgjs {
 
@@ -35,6 +46,7 @@ namespace vgjs {
     template<typename PT, typename... Ts> struct awaitable_tuple; //co_await a tuple of vectors
     template<typename PT, typename T> struct awaitable_coro; //co_await coros, functions, vectors
     template<typename PT> struct awaitable_resume_on; //change the thread
+    template<typename PT, typename T> struct awaitable_when_any; //co_await the first of a vector of coros
     template<typename U> struct yield_awaiter;  //co_yield
     template<typename U> struct final_awaiter;  //final_suspend
 
@@ -114,6 +126,143 @@ namespace vgjs {
     };
 
 
+    //---------------------------------------------------------------------------------------------------
+    //Memory resource for coroutine frames
+
+    /**
+    * \brief Lock-free pool with size classes for allocating coroutine frames.
+    *
+    * Each thread owns one pool, which is the default allocator for Coros that are not given
+    * a memory resource with std::allocator_arg. Only the owner allocates from its pool, so the
+    * free lists need no synchronization. A frame freed by another thread is pushed with a CAS 
+    * onto the owner's remote list of that size class, and the owner takes back the whole 
+    * list in one exchange once its own list runs empty.
+    * When the owner thread exits, its pool is deleted as soon as the last of its frames has been
+    * freed, so frames can be freed from any thread at any time.
+    */
+    class Coro_frame_pool : public std::pmr::memory_resource {
+        static const std::size_t c_num_classes = 7;                     ///<block sizes 64, 128, ..., 4096 bytes
+        static const std::size_t c_min_block = c_cache_line_size;      ///<smallest block size
+        static const std::size_t c_max_block = c_min_block << (c_num_classes - 1); ///<larger frames go upstream
+        static const std::size_t c_chunk_size = 1 << 16;                ///<bytes fetched from upstream at once
+
+        struct Block {
+            Block* m_next = nullptr;        ///<next free block in the list
+        };
+
+        std::pmr::memory_resource*  m_upstream;                         ///<chunks and large frames come from here
+        Block*                      m_free[c_num_classes] = {};         ///<free lists of the owner thread
+        Block*                      m_chunks = nullptr;                 ///<all chunks, for releasing them
+        char*                       m_chunk_ptr = nullptr;              ///<next free byte in the current chunk
+        std::size_t                 m_chunk_left = 0;                   ///<bytes left in the current chunk
+        int64_t                     m_owned = 0;                        ///<blocks allocated minus blocks freed by the owner
+        alignas(c_cache_line_size) std::atomic<Block*> m_remote[c_num_classes] = {}; ///<blocks freed by other threads
+        std::atomic<int64_t>        m_outstanding = 0;                  ///<minus the blocks freed by other threads, plus m_owned once the owner exited
+
+        struct Owner {                          ///<gives up the pool of a thread when the thread exits
+            Coro_frame_pool* m_pool;            ///<the pool owned by this thread, thread_local so zero-initialized
+            ~Owner() noexcept;
+        };
+
+        static inline thread_local Owner m_owner;
+
+        static std::size_t size_class(std::size_t bytes) noexcept {
+            std::size_t idx = 0;
+            for (std::size_t size = c_min_block; size < bytes; size <<= 1) ++idx;
+            return idx;
+        }
+
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            if (bytes > c_max_block || alignment > c_cache_line_size) {
+                return m_upstream->allocate(bytes, alignment);
+            }
+            auto idx = size_class(bytes);
+            Block* block = m_free[idx];
+            if (block == nullptr) {                                              //own list is empty
+                block = m_remote[idx].exchange(nullptr, std::memory_order_acquire); //take back frames freed by others
+            }
+            ++m_owned;
+            if (block != nullptr) {
+                m_free[idx] = block->m_next;
+                return block;
+            }
+
+            std::size_t size = c_min_block << idx;
+            if (m_chunk_left < size) {                                          //get a new chunk from upstream
+                Block* chunk = (Block*)m_upstream->allocate(c_chunk_size, c_cache_line_size);
+                chunk->m_next = m_chunks;                                       //first block of a chunk links the chunks
+                m_chunks = chunk;
+                m_chunk_ptr = (char*)chunk + c_min_block;
+                m_chunk_left = c_chunk_size - c_min_block;
+            }
+            void* ptr = m_chunk_ptr;
+            m_chunk_ptr += size;
+            m_chunk_left -= size;
+            return ptr;
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+            if (bytes > c_max_block || alignment > c_cache_line_size) {
+                m_upstream->deallocate(p, bytes, alignment);
+                return;
+            }
+            auto idx = size_class(bytes);
+            Block* block = (Block*)p;
+            if (m_owner.m_pool == this) {               //the owner frees, so use the own list
+                block->m_next = m_free[idx];
+                m_free[idx] = block;
+                --m_owned;
+                return;
+            }
+            block->m_next = m_remote[idx].load(std::memory_order_relaxed);  //send it back to the owner
+            while (!m_remote[idx].compare_exchange_weak(block->m_next, block, std::memory_order_release, std::memory_order_relaxed));
+            if (m_outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {  //only reaches 0 after the owner exited
+                delete this;                                                    //this was its last frame
+            }
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        Coro_frame_pool(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) noexcept : m_upstream(upstream) {};
+        Coro_frame_pool(const Coro_frame_pool&) = delete;
+
+        ~Coro_frame_pool() noexcept {
+            while (m_chunks != nullptr) {
+                Block* next = m_chunks->m_next;
+                m_upstream->deallocate(m_chunks, c_chunk_size, c_cache_line_size);
+                m_chunks = next;
+            }
+        }
+
+        /**
+        * \brief Get the pool of the calling thread, create it if necessary.
+        * \returns the pool owned by this thread.
+        */
+        static Coro_frame_pool* thread_pool() noexcept {
+            if (m_owner.m_pool == nullptr) {
+                m_owner.m_pool = new Coro_frame_pool{};  //deleted after the thread exited and all its frames were freed
+            }
+            return m_owner.m_pool;
+        }
+    };
+
+    /**
+    * \brief The owner thread exits. Its pool is deleted now if all its frames have been freed,
+    * else by the other thread that frees the last one.
+    */
+    inline Coro_frame_pool::Owner::~Owner() noexcept {
+        Coro_frame_pool* pool = m_pool;
+        if (pool == nullptr) return;
+        m_pool = nullptr;   //from now on this thread frees remotely, like every other thread
+        if (pool->m_outstanding.fetch_add(pool->m_owned, std::memory_order_acq_rel) + pool->m_owned == 0) {
+            delete pool;
+        }
+    }
+
+
     //---------------------------------------------------------------------------------------------------
     //Awaitables
 
@@ -152,19 +301,99 @@ namespace vgjs {
     template<typename PT, typename T>
     struct awaitable_coro {
         struct awaiter : std::experimental::suspend_always {
-            T& m_child;                      //child/children
+            T&      m_child;                //child/children
+            int32_t m_inline;               //-1 use JobSystem::inline_awaits(), 0 schedule, 1 run a single child inline
 
             bool await_ready() noexcept;
-            void await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept;
-            awaiter(T& child) noexcept : m_child(child) {};
+            std::experimental::coroutine_handle<> await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept;
+            awaiter(T& child, int32_t run_inline) noexcept : m_child(child), m_inline(run_inline) {};
         };
 
-        T& m_child;                     //child/children
+        T&      m_child;                    //child/children
+        int32_t m_inline = -1;
 
-        awaitable_coro(T& child) noexcept : m_child(child) {};
+        awaitable_coro(T& child, int32_t run_inline = -1) noexcept : m_child(child), m_inline(run_inline) {};
         awaiter operator co_await() noexcept;
     };
 
+    /**
+    * \brief A single Coro or function to await, with the choice whether it runs inline.
+    */
+    template<typename T>
+    struct inlined_child {
+        T&   m_child;
+        bool m_inline;
+    };
+
+    /**
+    * \brief Choose for one co_await whether the single child runs on the awaiting thread, 
+    * regardless of JobSystem::set_inline_awaits(), e.g. co_await inlined(child).
+    * \param[in] child A Coro, Function, std::function or callable.
+    * \param[in] on If true, run the child inline if possible, else schedule it.
+    * \returns the child with the choice, to be awaited.
+    */
+    template<typename T>
+    requires (!is_pmr_vector<T>::value)
+    inline inlined_child<T> inlined(T& child, bool on = true) noexcept {
+        return { child, on };
+    }
+
+
+    /**
+    * \brief Outcome of a when_any() race, shared by the awaiting coro and the racing children.
+    */
+    template<typename T>
+    struct when_any_state {
+        Job_base*           m_parent = nullptr;     //the awaiting coro
+        std::atomic<bool>   m_done = false;         //set by the first child that finishes
+        std::size_t         m_index = 0;            //index of this child
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> m_value;  //its result, only made by the winner
+    };
+
+    /**
+    * \brief A vector of Coros of which only the first to finish is awaited.
+    */
+    template<typename T>
+    struct when_any_children {
+        std::pmr::vector<Coro<T>>& m_children;
+    };
+
+    /**
+    * \brief Awaiter for awaiting the first Coro of a vector to finish.
+    *
+    * The children are detached from the caller, so the caller goes on as soon as one of them is done.
+    * The others are not waited for: those already running finish on their own and their results are dropped,
+    * those that have not started yet are never run.
+    */
+    template<typename PT, typename T>
+    struct awaitable_when_any {
+        struct awaiter : std::experimental::suspend_always {
+            std::pmr::vector<Coro<T>>&          m_children;     //the racing children, moved out when suspending
+            std::shared_ptr<when_any_state<T>>  m_state;        //outcome of the race
+
+            bool await_ready() noexcept { assert(!m_children.empty()); return false; };
+            std::experimental::coroutine_handle<> await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept;
+            auto await_resume() noexcept;
+            awaiter(std::pmr::vector<Coro<T>>& children) noexcept : m_children(children) {};
+        };
+
+        std::pmr::vector<Coro<T>>& m_children;      //the racing children
+
+        awaitable_when_any(std::pmr::vector<Coro<T>>& children) noexcept : m_children(children) {};
+        awaiter operator co_await() noexcept { return { m_children }; };
+    };
+
+    /**
+    * \brief Race Coros against each other, e.g. auto [index, value] = co_await when_any(children).
+    * \param[in] children The Coros to race, must not be empty. They are moved out of the vector when awaited.
+    * \returns the children to be awaited. co_await then returns the index of the first child that finished,
+    * for Coro<T> together with its result as std::pair<std::size_t, T>. T needs neither a default constructor nor a copy.
+    */
+    template<typename T>
+    inline when_any_children<T> when_any(std::pmr::vector<Coro<T>>& children) noexcept {
+        return { children };
+    }
+
 
     /**
     * \brief Awaiter for changing the thread that the coro is run on.
@@ -196,7 +425,7 @@ namespace vgjs {
     */
     template<typename U>
     struct yield_awaiter : public std::experimental::suspend_always {
-        void await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept;
+        std::experimental::coroutine_handle<> await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept;
     };
 
 
@@ -206,13 +435,14 @@ namespace vgjs {
     * Suspending as last act prevents the promise to be destroyed. This way the caller
     * can retrieve the stored value by calling get(). Also we want to resume the parent
     * if all children have finished their Coros.
-    * If the parent was a Job, then if the Coro<T> is still alive, the coro will suspend,
-    * and the Coro<T> must destroy the promise in its destructor. If the Coro<T> has destructed,
-    * then the coro must destroy the promise itself by resuming the final awaiter.
+    * If the parent was a Job, then the coro and the Coro<T> share the promise through a reference
+    * count. If the Coro<T> is still alive, the coro will suspend, and the Coro<T> must destroy the promise
+    * in its destructor. If the Coro<T> has destructed, then the coro destroys the promise itself
+    * by not suspending.
     */
     template<typename U>
     struct final_awaiter : public std::experimental::suspend_always {
-        bool await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept;
+        std::experimental::coroutine_handle<> await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept;
     };
 
 
@@ -235,11 +465,24 @@ namespace vgjs {
         bool m_is_parent_function = current_job() == nullptr ? true : current_job()->is_function();
         bool* m_ready_ptr = nullptr; //points to flag which is true if value is ready, else false
 
+        static inline std::pmr::memory_resource* m_default_mr = nullptr; //if set, used instead of the frame pools
+
+        std::experimental::coroutine_handle<> notify_parent() noexcept;  //called by the final and yield awaiters
+
     public:
+        int32_t m_type = -1;         //for logging performance
+        int32_t m_id = -1;           //for logging performance
+
+        static void set_memory_resource(std::pmr::memory_resource* mr) noexcept { m_default_mr = mr; }; //e.g. a FrameArena
+        static std::pmr::memory_resource* memory_resource() noexcept;
+
         Coro_promise_base(std::experimental::coroutine_handle<> coro) noexcept : m_coro(coro) {};
         void                                unhandled_exception() noexcept { std::terminate(); };
         std::experimental::suspend_always   initial_suspend() noexcept { return {}; };
         bool                                resume() noexcept;
+        std::experimental::coroutine_handle<> resume_handle() noexcept;
+        int32_t                             type() noexcept { return m_type; };
+        int32_t                             id() noexcept { return m_id; };
 
         template<typename... Args>
         void* operator new(std::size_t sz, std::allocator_arg_t, std::pmr::memory_resource* mr, Args&&... args) noexcept;
@@ -265,20 +508,25 @@ namespace vgjs {
     */
     template<typename T = void>
     class Coro_promise : public Coro_promise_base {
-        template<typename T> friend struct yield_awaiter;
-        template<typename T> friend struct final_awaiter;
-        template<typename T> friend class Coro;
+        template<typename U> friend struct yield_awaiter;
+        template<typename U> friend struct final_awaiter;
+        template<typename U> friend class Coro;
 
     protected:
-        std::shared_ptr<std::pair<bool, T>> m_value_ptr;  //a shared view of the return value
-        std::pair<bool, T>                  m_value;
+        std::optional<std::pair<bool, T>> m_value;  //the return value, lives as long as the frame, made by the first result if T has no default constructor
+        std::atomic<int>    m_refs = 2;     //if the parent is a Job, the frame is destroyed by the last of coro and future
+
+        template<typename U>
+        void store(U&& t) noexcept;
 
     public:
         Coro_promise() noexcept;
-        job_deallocator get_deallocator() noexcept { return coro_deallocator<T>{}; };    //called for deallocation
+        job_deallocator& get_deallocator() noexcept { static coro_deallocator<T> da; return da; };    //called for deallocation
         Coro<T>         get_return_object() noexcept;
-        void            return_value(T t) noexcept;
-        yield_awaiter<T> yield_value(T t) noexcept;
+        void            return_value(const T& t) noexcept;
+        void            return_value(T&& t) noexcept;
+        yield_awaiter<T> yield_value(const T& t) noexcept;
+        yield_awaiter<T> yield_value(T&& t) noexcept;
 
         template<typename... Ts>
         awaitable_tuple<T, Ts...> await_transform(std::tuple<std::pmr::vector<Ts>...>& tuple) noexcept { return { tuple }; };
@@ -286,6 +534,12 @@ namespace vgjs {
         template<typename U>
         awaitable_coro<T, U>      await_transform(U& coro) noexcept { return { coro }; };
 
+        template<typename U>
+        awaitable_coro<T, U>      await_transform(inlined_child<U> child) noexcept { return { child.m_child, child.m_inline ? 1 : 0 }; };
+
+        template<typename U>
+        awaitable_when_any<T, U>  await_transform(when_any_children<U> children) noexcept { return { children.m_children }; };
+
         awaitable_resume_on<T>    await_transform(int thread_index) noexcept { return { (int32_t)thread_index}; };
 
         final_awaiter<T>          final_suspend() noexcept { return {}; };
@@ -322,24 +576,22 @@ namespace vgjs {
     public:
         using promise_type = Coro_promise<T>;
         bool m_is_parent_function;
-        std::shared_ptr<std::pair<bool, T>> m_value_ptr;
 
     private:
         std::experimental::coroutine_handle<promise_type> m_coro;   //handle to Coro promise
 
     public:
-        explicit Coro(  std::experimental::coroutine_handle<promise_type> h,
-                        std::shared_ptr<std::pair<bool, T>>& value_ptr,
-                        bool is_parent_function) noexcept;
+        explicit Coro(std::experimental::coroutine_handle<promise_type> h, bool is_parent_function) noexcept;
 
-        Coro(Coro<T>&& t)  noexcept : Coro_base(t.m_promise), m_coro(std::exchange(t.m_coro, {})),
-                                        m_value_ptr(std::exchange(t.m_value_ptr, {})),
-                                        m_is_parent_function(std::exchange(t.m_is_parent_function, {})) {};
+        Coro(Coro<T>&& t)  noexcept : Coro_base(t.m_promise), m_is_parent_function(std::exchange(t.m_is_parent_function, {})),
+                                        m_coro(std::exchange(t.m_coro, {})) {};
 
         void operator= (Coro<T>&& t) noexcept;
         ~Coro() noexcept;
 
-        std::pair<bool, T>  get() noexcept;
+        std::pair<bool, T>& get() noexcept;
+        std::pair<bool, T>  take() noexcept;
+        Coro<T>&&           detach() noexcept;
         Coro<T>&&           operator() (int32_t thread_index = -1, int32_t type = -1, int32_t id = -1);
     };
 
@@ -352,7 +604,7 @@ namespace vgjs {
     */
     template<>
     struct yield_awaiter<void> : public std::experimental::suspend_always {
-        void await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept;
+        std::experimental::coroutine_handle<> await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept;
     };
 
     /**
@@ -360,7 +612,7 @@ namespace vgjs {
     */
     template<>
     struct final_awaiter<void> : public std::experimental::suspend_always {
-        bool await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept;
+        std::experimental::coroutine_handle<> await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept;
     };
 
     /**
@@ -374,7 +626,7 @@ namespace vgjs {
 
     public:
         Coro_promise() noexcept;
-        job_deallocator get_deallocator() noexcept { return coro_deallocator<void>{}; };    //called for deallocation
+        job_deallocator& get_deallocator() noexcept { static coro_deallocator<void> da; return da; };    //called for deallocation
         Coro<void>      get_return_object() noexcept;
         void            return_void() noexcept {};
         yield_awaiter<void> yield_value() noexcept { return {}; };
@@ -385,6 +637,12 @@ namespace vgjs {
         template<typename U>
         awaitable_coro<void, U>      await_transform(U& coro) noexcept { return { coro }; };
 
+        template<typename U>
+        awaitable_coro<void, U>      await_transform(inlined_child<U> child) noexcept { return { child.m_child, child.m_inline ? 1 : 0 }; };
+
+        template<typename U>
+        awaitable_when_any<void, U>  await_transform(when_any_children<U> children) noexcept { return { children.m_children }; };
+
         awaitable_resume_on<void>    await_transform(int thread_index) noexcept { return (int32_t)thread_index; };
 
         final_awaiter<void>          final_suspend() noexcept { return {}; };
@@ -408,10 +666,11 @@ namespace vgjs {
     public:
         explicit Coro(std::experimental::coroutine_handle<promise_type> coro, bool is_parent_function) noexcept 
             : Coro_base(&coro.promise()), m_is_parent_function(is_parent_function), m_coro(coro) {};
-        Coro(Coro<void>&& t)  noexcept : Coro_base(t.m_promise), m_coro(std::exchange(t.m_coro, {})) {};
+        Coro(Coro<void>&& t)  noexcept : Coro_base(t.m_promise), m_is_parent_function(t.m_is_parent_function), m_coro(std::exchange(t.m_coro, {})) {};
 
-        void operator= (Coro<void>&& t) noexcept { std::swap(m_coro, t.m_coro); };
+        void operator= (Coro<void>&& t) noexcept;
         ~Coro() noexcept;
+        Coro<void>&&       detach() noexcept;
         Coro<void>&&       operator() (int32_t thread_index = -1, int32_t type = -1, int32_t id = -1);
     };
 
@@ -471,6 +730,8 @@ namespace vgjs {
     */
     template<typename PT, typename... Ts>
     inline void awaitable_tuple<PT, Ts...>::awaiter::await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept {
+        JobSystem::instance().log_suspend(&h.promise());   //before any child can resume the coro
+
         auto g = [&, this]<typename T>(std::pmr::vector<T> & vec) {
             schedule(vec, &h.promise(), (int)m_number);    //in first call the number of children is the total number of all jobs
             m_number = 0;                               //after this always 0
@@ -501,17 +762,47 @@ namespace vgjs {
     }
 
     /**
-    * \brief Forward the child to the correct version of schedule()
+    * \brief Forward the child to the correct version of schedule(), or run a single child inline.
+    *
+    * Inline, a child coro is resumed by symmetric transfer, and when it finishes it transfers back
+    * to the parent. A function runs right away, and if it started no children, the parent goes on.
+    * JobSystem::transfer() and JobSystem::run_inline() fall back to scheduling if needed.
+    *
     * \param[in] h The coro handle, can be used to get the promise which is the parent of the children.
+    * \returns the coro to resume on this thread, or the noop coroutine to return to the thread.
     */
     template<typename PT, typename T>
-    inline void awaitable_coro<PT, T>::awaiter::await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept {
-        schedule(std::forward<T>(m_child), &h.promise());  //schedule the coro, function or vector
+    inline std::experimental::coroutine_handle<> awaitable_coro<PT, T>::awaiter::await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept {
+        JobSystem::instance().log_suspend(&h.promise());   //before the child can resume the coro
+
+        if constexpr (!is_pmr_vector<T>::value) {
+            if (m_inline > 0 || (m_inline < 0 && JobSystem::instance().inline_awaits())) {
+                if constexpr (CORO<T>) {
+                    auto child = m_child.promise();
+                    h.promise().m_children.fetch_add(1);
+                    child->m_parent = &h.promise();
+                    auto handle = child->resume_handle();
+                    if (!handle.done() && JobSystem::instance().transfer(child)) {
+                        return handle;                          //run the child on this thread
+                    }
+                    JobSystem::instance().schedule(child);
+                }
+                else if constexpr (FUNCTOR<T>) {
+                    if (JobSystem::instance().run_inline(m_child, &h.promise())) return h;   //the function is done, go on
+                }
+                else {
+                    if (JobSystem::instance().run_inline(std::move(m_child), &h.promise())) return h;
+                }
+                return std::experimental::noop_coroutine();
+            }
+        }
+        schedule(m_child, &h.promise());    //schedule the coro, function or vector
+        return std::experimental::noop_coroutine();
     }
 
     //co_await operator is defined for this awaitable, and results in the awaiter
     template<typename PT, typename T>
-    inline typename awaitable_coro<PT, T>::awaiter awaitable_coro<PT, T>::operator co_await() noexcept { return { m_child }; };
+    inline typename awaitable_coro<PT, T>::awaiter awaitable_coro<PT, T>::operator co_await() noexcept { return { m_child, m_inline }; };
 
     //--------------------------------------------------------------------------------------------------
 
@@ -530,6 +821,7 @@ namespace vgjs {
     template<typename PT>
     inline void awaitable_resume_on<PT>::awaiter::await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept {
         h.promise().m_thread_index = m_thread_index;
+        JobSystem::instance().log_suspend(&h.promise());
         JobSystem::instance().schedule(&h.promise());
     }
 
@@ -543,21 +835,11 @@ namespace vgjs {
     * \param[in] h Handle of the coro, is used to get the promise (=Job)
     */
     template<typename U>
-    inline void yield_awaiter<U>::await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
+    inline std::experimental::coroutine_handle<> yield_awaiter<U>::await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
         auto& promise = h.promise();
+        JobSystem::instance().log_suspend(&promise);   //before the parent can resume the coro
 
-        if (promise.m_parent != nullptr) {          //if there is a parent
-            if (promise.m_is_parent_function) {       //if it is a Job
-                JobSystem::instance().child_finished((Job*)promise.m_parent); //indicate that this child has finished
-            }
-            else {  //parent is a coro
-                uint32_t num = promise.m_parent->m_children.fetch_sub(1);   //one less child
-                if (num == 1) {                                             //was it the last child?
-                    JobSystem::instance().schedule(promise.m_parent);      //if last reschedule the parent coro
-                }
-            }
-        }
-        return;
+        return promise.notify_parent();             //the parent goes on, maybe right here
     }
 
 
@@ -565,21 +847,11 @@ namespace vgjs {
     * \brief After suspension, call parent to run it as continuation
     * \param[in] h Handle of the coro, is used to get the promise (=Job)
     */
-    inline void yield_awaiter<void>::await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
+    inline std::experimental::coroutine_handle<> yield_awaiter<void>::await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
         Coro_promise<void>& promise = h.promise();
+        JobSystem::instance().log_suspend(&promise);   //before the parent can resume the coro
 
-        if (promise.m_parent != nullptr) {          //if there is a parent
-            if (promise.m_is_parent_function) {       //if it is a Job
-                JobSystem::instance().child_finished((Job*)promise.m_parent); //indicate that this child has finished
-            }
-            else {  //parent is a coro
-                uint32_t num = promise.m_parent->m_children.fetch_sub(1);   //one less child
-                if (num == 1) {                                             //was it the last child?
-                    JobSystem::instance().schedule(promise.m_parent);      //if last reschedule the parent coro
-                }
-            }
-        }
-        return;
+        return promise.notify_parent();             //the parent goes on, maybe right here
     }
 
     //---------------------------------------------------------------------------------------------------
@@ -589,21 +861,16 @@ namespace vgjs {
     * \param[in] h Handle of the coro, is used to get the promise (=Job)
     */
     template<typename U>
-    inline bool final_awaiter<U>::await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
+    inline std::experimental::coroutine_handle<> final_awaiter<U>::await_suspend(std::experimental::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
         auto& promise = h.promise();
+        JobSystem::instance().log_coro_end(&promise);   //before the parent can resume and destroy the coro
 
-        if (promise.m_parent != nullptr) {          //if there is a parent
-            if (promise.m_is_parent_function) {       //if it is a Job
-                JobSystem::instance().child_finished((Job*)promise.m_parent);//indicate that this child has finished
-            }
-            else {
-                uint32_t num = promise.m_parent->m_children.fetch_sub(1);        //one less child
-                if (num == 1) {                                             //was it the last child?
-                    JobSystem::instance().schedule(promise.m_parent);      //if last reschedule the parent coro
-                }
-            }
+        bool is_parent_function = promise.m_is_parent_function;  //a parent coro may destroy the promise
+        auto next = promise.notify_parent();
+        if (is_parent_function && promise.m_refs.fetch_sub(1) == 1) {
+            h.destroy();    //the future is gone, so destroy the promise, else the future does it
         }
-        return !promise.m_is_parent_function; //if parent is coro, then you are in sync -> the future will destroy the promise
+        return next;        //if parent is coro, then you are in sync -> the future will destroy the promise
     }
 
 
@@ -611,21 +878,16 @@ namespace vgjs {
     * \brief After suspension, call parent to run it as continuation
     * \param[in] h Handle of the coro, is used to get the promise (=Job)
     */
-    inline bool final_awaiter<void>::await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
+    inline std::experimental::coroutine_handle<> final_awaiter<void>::await_suspend(std::experimental::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
         Coro_promise<void>& promise = h.promise();
+        JobSystem::instance().log_coro_end(&promise);   //before the parent can resume and destroy the coro
 
-        if (promise.m_parent != nullptr) {          //if there is a parent
-            if (promise.m_is_parent_function) {       //if it is a Job
-                JobSystem::instance().child_finished((Job*)promise.m_parent);//indicate that this child has finished
-            }
-            else {
-                uint32_t num = promise.m_parent->m_children.fetch_sub(1);        //one less child
-                if (num == 1) {                                             //was it the last child?
-                    JobSystem::instance().schedule(promise.m_parent);      //if last reschedule the parent coro
-                }
-            }
+        bool is_parent_function = promise.m_is_parent_function;  //a parent coro may destroy the promise
+        auto next = promise.notify_parent();
+        if (is_parent_function) {
+            h.destroy();    //nobody waits for the result
         }
-        return !promise.m_is_parent_function; //if parent is coro, then you are in sync -> the future will destroy the promise
+        return next;        //if parent is coro, then you are in sync -> the future will destroy the promise
     }
 
 
@@ -647,12 +909,49 @@ namespace vgjs {
         return true;
     };
 
+    /**
+    * \brief Prepare resuming the Coro by symmetric transfer, like resume() does.
+    * \returns the handle of the coro.
+    */
+    inline std::experimental::coroutine_handle<> Coro_promise_base::resume_handle() noexcept {
+        if (m_is_parent_function && m_ready_ptr != nullptr) {
+            *m_ready_ptr = false;   //invalidate return value
+        }
+        return m_coro;
+    };
+
+    /**
+    * \brief A child coro finished or yielded, so tell its parent.
+    *
+    * If the parent is a coro and this was its last child, then the parent can go on. Instead of
+    * pushing it into a queue, where another thread might pick it up with cold caches, this thread
+    * resumes it right away by returning its handle from the awaiter, if JobSystem::transfer() allows it.
+    *
+    * \returns the handle of the parent coro to resume, or the noop coroutine to return to the thread.
+    */
+    inline std::experimental::coroutine_handle<> Coro_promise_base::notify_parent() noexcept {
+        if (m_parent != nullptr) {                  //if there is a parent
+            if (m_is_parent_function) {             //if it is a Job
+                JobSystem::instance().child_finished(m_parent);  //indicate that this child has finished
+            }
+            else if (m_parent->m_children.fetch_sub(1) == 1) {         //was it the last child of the parent coro?
+                Job_base* parent = m_parent;
+                if (JobSystem::instance().transfer(parent)) {
+                    return ((Coro_promise_base*)parent)->resume_handle();  //resume it on this thread
+                }
+                JobSystem::instance().schedule(parent);                //else reschedule the parent coro
+            }
+        }
+        return std::experimental::noop_coroutine();
+    }
+
     /**
     * \brief Use the given memory resource to create the promise object for a normal function.
     *
     * Store the pointer to the memory resource right after the promise, so it can be used later
-    * for deallocating the promise.
-*
+    * for deallocating the promise. The frame is aligned to a cache line, so that promises
+    * of different coros never share a line.
+    *
     * \param[in] sz Number of bytes to allocate.
     * \param[in] std::allocator_arg_t Dummy parameter to indicate that the next parameter is the memory resource to use.
     * \param[in] mr The memory resource to use when allocating the promise.
@@ -663,7 +962,7 @@ namespace vgjs {
     inline void* Coro_promise_base::operator new(std::size_t sz, std::allocator_arg_t, std::pmr::memory_resource* mr, Args&&... args) noexcept {
         //std::cout << "Coro new " << sz << "\n";
         auto allocatorOffset = (sz + alignof(std::pmr::memory_resource*) - 1) & ~(alignof(std::pmr::memory_resource*) - 1);
-        char* ptr = (char*)mr->allocate(allocatorOffset + sizeof(mr));
+        char* ptr = (char*)mr->allocate(allocatorOffset + sizeof(mr), c_cache_line_size);
         if (ptr == nullptr) {
             std::terminate();
         }
@@ -690,7 +989,18 @@ namespace vgjs {
     }
 
     /**
-    * \brief Create a promise object for a class member function using the system standard allocator.
+    * \brief Get the memory resource for promises that are not given one with std::allocator_arg.
+    * \returns the resource set with set_memory_resource(), or else the frame pool of this thread.
+    */
+    inline std::pmr::memory_resource* Coro_promise_base::memory_resource() noexcept {
+        if (m_default_mr != nullptr) {
+            return m_default_mr;
+        }
+        return Coro_frame_pool::thread_pool();
+    }
+
+    /**
+    * \brief Create a promise object for a class member function using the default memory resource.
     * \param[in] sz Number of bytes to allocate.
     * \param[in] Class The class that defines this member function.
     * \param[in] args the rest of the coro args.
@@ -698,18 +1008,18 @@ namespace vgjs {
     */
     template<typename Class, typename... Args>
     inline void* Coro_promise_base::operator new(std::size_t sz, Class, Args&&... args) noexcept {
-        return operator new(sz, std::allocator_arg, std::pmr::new_delete_resource(), args...);
+        return operator new(sz, std::allocator_arg, memory_resource(), args...);
     }
 
     /**
-    * \brief Create a promise object using the system standard allocator.
+    * \brief Create a promise object using the default memory resource.
     * \param[in] sz Number of bytes to allocate.
     * \param[in] args the rest of the coro args.
     * \returns a pointer to the newly allocated promise.
     */
     template<typename... Args>
     inline void* Coro_promise_base::operator new(std::size_t sz, Args&&... args) noexcept {
-        return operator new(sz, std::allocator_arg, std::pmr::new_delete_resource(), args...);
+        return operator new(sz, std::allocator_arg, memory_resource(), args...);
     }
 
     /**
@@ -721,7 +1031,7 @@ namespace vgjs {
         //std::cout << "Coro delete " << sz << "\n";
         auto allocatorOffset = (sz + alignof(std::pmr::memory_resource*) - 1) & ~(alignof(std::pmr::memory_resource*) - 1);
         auto allocator = (std::pmr::memory_resource**)((char*)(ptr)+allocatorOffset);
-        (*allocator)->deallocate(ptr, allocatorOffset + sizeof(std::pmr::memory_resource*));
+        (*allocator)->deallocate(ptr, allocatorOffset + sizeof(std::pmr::memory_resource*), c_cache_line_size);
     }
 
     //---------------------------------------------------------------------------------------------------
@@ -732,6 +1042,9 @@ namespace vgjs {
     template<typename T>
     inline Coro_promise<T>::Coro_promise() noexcept
        : Coro_promise_base{ std::experimental::coroutine_handle<Coro_promise<T>>::from_promise(*this) } {
+        if constexpr (std::is_default_constructible_v<T>) {
+            m_value.emplace();      //get() can be called before the first result
+        }
     };
 
     /**
@@ -742,20 +1055,15 @@ namespace vgjs {
     };
 
     /**
-    * \brief Get Coro<T> from the Coro_promise<T>. Creates a shared value to trade the result.
+    * \brief Get Coro<T> from the Coro_promise<T>. The result stays in the promise.
     * \returns the Coro<T> from the promise.
     */
     template<typename T>
     inline Coro<T> Coro_promise<T>::get_return_object() noexcept {
-        m_ready_ptr = &m_value.first;
-        if (m_is_parent_function) {
-            m_value_ptr = std::make_shared<std::pair<bool, T>>(std::make_pair(false, T{}));
-            m_ready_ptr = &(m_value_ptr->first);
+        if (m_value) {
+            m_ready_ptr = &m_value->first;
         }
-
-        return Coro<T>{
-            std::experimental::coroutine_handle<Coro_promise<T>>::from_promise(*this),
-                m_value_ptr, m_is_parent_function };
+        return Coro<T>{ std::experimental::coroutine_handle<Coro_promise<T>>::from_promise(*this), m_is_parent_function };
     }
 
     /**
@@ -767,31 +1075,58 @@ namespace vgjs {
     }
 
     /**
-    * \brief Store the value returned by co_return.
-    * \param[in] t The value that was returned.
+    * \brief Store a result in the promise. If T has no default constructor, the first result constructs it.
+    * \param[in] t The result, is copied or moved.
     */
     template<typename T>
-    inline void Coro_promise<T>::return_value(T t) noexcept {   //is called by co_return <VAL>, saves <VAL> in m_value
-        if (m_is_parent_function) {
-            *m_value_ptr = std::make_pair(true, t);
+    template<typename U>
+    inline void Coro_promise<T>::store(U&& t) noexcept {
+        if (m_value) {
+            m_value->second = std::forward<U>(t);
+            m_value->first = true;
             return;
         }
-        m_value = std::make_pair(true, t);
+        m_value.emplace(true, std::forward<U>(t));
+        m_ready_ptr = &m_value->first;
+    }
+
+    /**
+    * \brief Store the value returned by co_return.
+    * \param[in] t The value that was returned, is copied.
+    */
+    template<typename T>
+    inline void Coro_promise<T>::return_value(const T& t) noexcept {   //is called by co_return <VAL>, saves <VAL> in m_value
+        store(t);
+    }
+
+    /**
+    * \brief Store the value returned by co_return.
+    * \param[in] t The value that was returned, is moved.
+    */
+    template<typename T>
+    inline void Coro_promise<T>::return_value(T&& t) noexcept {        //is called by co_return <VAL>, saves <VAL> in m_value
+        store(std::move(t));
     }
 
     /**
     * \brief Store the value returned by co_yield.
-    * \param[in] t The value that was yielded
+    * \param[in] t The value that was yielded, is copied.
     * \returns a yield_awaiter
     */
     template<typename T>
-    inline yield_awaiter<T> Coro_promise<T>::yield_value(T t) noexcept {
-        if (m_is_parent_function) {
-            *m_value_ptr = std::make_pair(true, t);
-        }
-        else {
-            m_value = std::make_pair(true, t);
-        }
+    inline yield_awaiter<T> Coro_promise<T>::yield_value(const T& t) noexcept {
+        store(t);
+        return {};  //return a yield_awaiter
+    }
+
+    /**
+    * \brief Store the value returned by co_yield.
+    * \param[in] t The value that was yielded, is moved.
+    * \returns a yield_awaiter
+    */
+    template<typename T>
+    inline yield_awaiter<T> Coro_promise<T>::yield_value(T&& t) noexcept {
+        store(std::move(t));
         return {};  //return a yield_awaiter
     }
 
@@ -804,35 +1139,42 @@ namespace vgjs {
     * \brief Coro future constructor
     */
     template<typename T>
-    inline Coro<T>::Coro(   std::experimental::coroutine_handle<typename Coro<T>::promise_type> h,
-                            std::shared_ptr<std::pair<bool, T>>& value_ptr, 
-                            bool is_parent_function) noexcept
-                                : Coro_base(&h.promise()), m_coro(h), m_is_parent_function(is_parent_function)  {
-        if (m_is_parent_function) {
-            m_value_ptr = value_ptr;
-        }
-    };
+    inline Coro<T>::Coro(std::experimental::coroutine_handle<typename Coro<T>::promise_type> h, bool is_parent_function) noexcept
+        : Coro_base(&h.promise()), m_is_parent_function(is_parent_function), m_coro(h)  {};
 
     /**
     * \brief Assignment operator
     */
     template<typename T>
     inline void Coro<T>::operator= (Coro<T>&& t) noexcept {
+        std::swap(m_promise, t.m_promise);
         std::swap(m_coro, t.m_coro);
-        std::swap(m_value_ptr, t.m_value_ptr);
-        std::swap(m_value, t.m_value);
+        std::swap(m_is_parent_function, t.m_is_parent_function);
     }
 
     /**
     * \brief Destructor of the Coro promise.
+    * If the parent is a Job, the promise is shared with the running coro, and the last one destroys it.
     */
     template<typename T>
     inline Coro<T>::~Coro() noexcept {
-        if (!m_is_parent_function && m_coro) {
+        if (!m_coro) {
+            return;
+        }
+        if (!m_is_parent_function || m_coro.promise().m_refs.fetch_sub(1) == 1) {
             m_coro.destroy();
         }
     }
 
+    /**
+    * \brief Assignment operator for void.
+    */
+    inline void Coro<void>::operator= (Coro<void>&& t) noexcept {
+        std::swap(m_promise, t.m_promise);
+        std::swap(m_coro, t.m_coro);
+        std::swap(m_is_parent_function, t.m_is_parent_function);
+    }
+
     inline Coro<void>::~Coro() noexcept {
         if (!m_is_parent_function && m_coro) {
             m_coro.destroy();
@@ -841,15 +1183,39 @@ namespace vgjs {
 
 
     /**
-    * \brief Retrieve the promised value or std::nullopt - nonblocking
-    * \returns the promised value or std::nullopt
+    * \brief Retrieve the promised value - nonblocking
+    * If T has no default constructor, the coro must have produced a result before.
+    * \returns a reference to the promised value, the bool is true if the value is ready
     */
     template<typename T>
-    inline std::pair<bool, T> Coro<T>::get() noexcept {
-        if (m_is_parent_function) {
-            return *m_value_ptr;
-        }
-        return m_coro.promise().m_value;
+    inline std::pair<bool, T>& Coro<T>::get() noexcept {
+        return *m_coro.promise().m_value;
+    }
+
+    /**
+    * \brief Move the promised value out of the promise - nonblocking
+    * Afterwards the value is no longer ready, so it can be taken only once.
+    * If T has no default constructor, the coro must have produced a result before.
+    * \returns the promised value, the bool is true if the value was ready
+    */
+    template<typename T>
+    inline std::pair<bool, T> Coro<T>::take() noexcept {
+        auto& value = *m_coro.promise().m_value;
+        std::pair<bool, T> res{ value.first, std::move(value.second) };
+        value.first = false;
+        return res;
+    }
+
+    /**
+    * \brief Nobody will await the coro, so it destroys its frame itself when it finishes,
+    * as if it had been created by a function.
+    * \returns a reference to this Coro so that it can be scheduled.
+    */
+    template<typename T>
+    inline Coro<T>&& Coro<T>::detach() noexcept {
+        m_is_parent_function = true;
+        m_coro.promise().m_is_parent_function = true;
+        return std::move(*this);
     }
 
     /**
@@ -883,6 +1249,85 @@ namespace vgjs {
         return std::move(*this);
     }
 
+    /**
+    * \brief Nobody will await the coro, so it destroys its frame itself when it finishes.
+    * \returns a reference to this Coro so that it can be scheduled.
+    */
+    inline Coro<void>&& Coro<void>::detach() noexcept {
+        m_is_parent_function = true;
+        m_coro.promise().m_is_parent_function = true;
+        return std::move(*this);
+    }
+
+
+    //---------------------------------------------------------------------------------------------------
+    //when_any
+
+    /**
+    * \brief Runs one child of a when_any() race. The first entry whose child finishes stores the result
+    * and wakes up the awaiting coro.
+    * \param[in] state The outcome of the race.
+    * \param[in] child The racing child, owned by the entry from now on.
+    * \param[in] index Index of the child in the awaited vector.
+    */
+    template<typename T>
+    inline Coro<> when_any_entry(std::shared_ptr<when_any_state<T>> state, Coro<T> child, std::size_t index) {
+        if (state->m_done.load(std::memory_order_acquire)) {
+            co_return;                              //lost before it started, the child never runs
+        }
+        co_await inlined(child);                    //run the child on this thread if possible
+
+        if (!state->m_done.exchange(true)) {        //first one wins
+            state->m_index = index;
+            if constexpr (!std::is_void_v<T>) {
+                state->m_value.emplace(std::move(child.take().second));
+            }
+            auto parent = state->m_parent;
+            if (parent->m_children.fetch_sub(1) == 1) {
+                JobSystem::instance().schedule(parent);     //the coro is already suspended, so wake it up
+            }
+        }
+        co_return;
+    }
+
+    /**
+    * \brief Start the race. Each child is moved into a detached entry coro.
+    * The coro holds an extra child count while scheduling, so it cannot be resumed
+    * before all children are out of the vector.
+    * \param[in] h The coro handle, can be used to get the promise which is waiting for the winner.
+    * \returns the coro itself if a child has already won, so it goes on right away, else the noop coroutine.
+    */
+    template<typename PT, typename T>
+    inline std::experimental::coroutine_handle<> awaitable_when_any<PT, T>::awaiter::await_suspend(std::experimental::coroutine_handle<Coro_promise<PT>> h) noexcept {
+        JobSystem::instance().log_suspend(&h.promise());   //before any child can resume the coro
+
+        m_state = std::make_shared<when_any_state<T>>();
+        m_state->m_parent = &h.promise();
+        h.promise().m_children.fetch_add(2);               //one for the winner, one for this loop
+
+        for (std::size_t i = 0; i < m_children.size(); ++i) {
+            schedule(when_any_entry<T>(m_state, std::move(m_children[i]), i).detach(), nullptr);
+        }
+        if (h.promise().m_children.fetch_sub(1) == 1) {
+            return h;
+        }
+        return std::experimental::noop_coroutine();
+    }
+
+    /**
+    * \brief Return the outcome of the race.
+    * \returns the index of the winner, for Coro<T> together with its result.
+    */
+    template<typename PT, typename T>
+    inline auto awaitable_when_any<PT, T>::awaiter::await_resume() noexcept {
+        if constexpr (std::is_void_v<T>) {
+            return m_state->m_index;
+        }
+        else {
+            return std::pair<std::size_t, T>{ m_state->m_index, std::move(*m_state->m_value) };
+        }
+    }
+
 
 }
 
@@ -34,6 +34,28 @@
 #include <chrono>
 #include <string>
 #include <sstream>
+#include <cstring>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <charconv>
+#include <string_view>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
 
 namespace vgjs {
 
@@ -41,10 +63,17 @@ namespace vgjs {
     class Job_base;
     class JobSystem;
 
+    constexpr std::size_t c_cache_line_size = 64;   ///<size of a cache line, used for padding shared data
+
+#if !defined(VGJS_LOCK_STATS)
+    #define VGJS_LOCK_STATS 0       ///<set to 1 to measure the contention of the job queue locks
+#endif
+    constexpr bool c_lock_stats = VGJS_LOCK_STATS != 0;
+
     bool is_logging();
-    void log_data(  std::chrono::high_resolution_clock::time_point& t1, std::chrono::high_resolution_clock::time_point& t2,
-                    int32_t exec_thread, bool finished, int32_t type, int32_t id);
+    void log_data(uint64_t t1, uint64_t t2, int32_t exec_thread, bool finished, int32_t type, int32_t id);
     void save_log_file();
+    void save_log_file_parallel();
 
 
 
@@ -102,58 +131,142 @@ namespace vgjs {
 
     /**
     * \brief Base class of coro task promises and jobs.
+    *
+    * Holds only the fields that are touched whenever a job is queued, run or finished.
+    * Metadata for logging is kept by the derived classes, away from this hot part.
     */
     class Job_base : public Queuable {
     public:
-        std::atomic<int>    m_children = 0;             //number of children this job is waiting for
         Job_base*           m_parent = nullptr;         //parent job that created this job
+        std::atomic<int>    m_children = 0;             //number of children this job is waiting for
         int32_t             m_thread_index = -1;        //thread that the job should run on and ran on
-        int32_t             m_type = -1;                //for logging performance
-        int32_t             m_id = -1;                  //for logging performance
         bool                m_is_function = false;      //default - this is not a function
+        bool                m_suspended = false;        //a coro suspended while logging, so its resumption ends a flow arrow
+        bool                m_lifetime = false;         //a coro whose first run is in the trace, so its end is logged too
+        uint32_t            m_enqueued = 0;             //low bits of the tick when the job was scheduled, 0 if not stamped
 
         virtual bool resume() = 0;                      //this is the actual work to be done
         void operator() () noexcept {           //wrapper as function operator
             resume();
         }
         bool is_function() noexcept { return m_is_function; }         //test whether this is a function or e.g. a coro
-        virtual job_deallocator get_deallocator() noexcept { return job_deallocator{}; };    //called for deallocation
+        virtual job_deallocator& get_deallocator() noexcept { static job_deallocator da; return da; };    //called for deallocation, by reference so it is not sliced
+        virtual int32_t type() noexcept { return -1; };     //type for logging performance
+        virtual int32_t id() noexcept { return -1; };       //id for logging performance
     };
 
 
+    /**
+    * \brief Callables that are stored directly in a Job, e.g. lambdas.
+    *
+    * Function and std::function have their own overloads, coros are scheduled as coros.
+    */
+    template<typename F>
+    concept FUNCTOR = std::is_invocable_v<std::decay_t<F>&> 
+        && !std::is_base_of_v<Queuable, std::decay_t<F>>
+        && !std::is_same_v<std::decay_t<F>, Function> 
+        && !std::is_same_v<std::decay_t<F>, std::function<void(void)>>;
+
+
     /**
     * \brief Job class calls normal C++ functions, is allocated and deallocated, and can be reused.
+    *
+    * The first cache line holds everything needed to run the job: the queue link, parent, children
+    * counter, the invoke pointer of the callable and the first bytes of its captures. Small lambdas
+    * thus never touch the second line, which holds larger captures and the cold metadata. 
+    * Callables larger than c_storage_size are allocated from m_mr.
     */
-    class Job : public Job_base {
+    class alignas(c_cache_line_size) Job : public Job_base {
+    public:
+        static const std::size_t c_storage_size = 56;   ///<bytes of captures stored in the job
+
+    protected:
+        using invoke_t = void(*)(Job* job, bool destroy);
+
+        invoke_t                    m_invoke = nullptr;         //calls or destroys the stored callable
+        alignas(std::max_align_t) char m_storage[c_storage_size];   //callable, or pointer to it if too large
+
     public:
-        std::pmr::memory_resource*  m_mr = nullptr;  //memory resource that was used to allocate this Job
         Job_base*                   m_continuation = nullptr;   //continuation follows this job (a coro is its own continuation)
-        std::function<void(void)>   m_function;      //function to compute
+        std::pmr::memory_resource*  m_mr = nullptr;             //memory resource that was used to allocate this Job
+        int32_t                     m_type = -1;                //for logging performance
+        int32_t                     m_id = -1;                  //for logging performance
 
         Job() : Job_base() {
             m_children = 1;
             m_is_function = true;
         }
 
+        ~Job() noexcept {
+            clear_function();
+        }
+
         void reset() noexcept {         //call only if you want to wipe out the Job data
             m_next = nullptr;           //e.g. when recycling from a used Jobs queue
             m_children = 1;
             m_parent = nullptr;
             m_continuation = nullptr;
             m_thread_index = -1;
+            m_enqueued = 0;
             m_type = -1;
             m_id = -1;
         }
 
+        /**
+        * \brief Store a callable in the job, in place if it fits, else allocated from m_mr.
+        * \param[in] f The callable.
+        */
+        template<typename F>
+        void set_function(F&& f) noexcept {
+            using T = std::decay_t<F>;
+            clear_function();
+            if constexpr (sizeof(T) <= c_storage_size && alignof(T) <= alignof(std::max_align_t)) {
+                new (m_storage) T(std::forward<F>(f));
+                m_invoke = [](Job* job, bool destroy) {
+                    T* func = std::launder(reinterpret_cast<T*>(job->m_storage));
+                    if (destroy) func->~T(); else (*func)();
+                };
+            }
+            else {
+                std::pmr::polymorphic_allocator<T> allocator(m_mr);
+                T* func = allocator.allocate(1);
+                new (func) T(std::forward<F>(f));
+                *reinterpret_cast<T**>(m_storage) = func;
+                m_invoke = [](Job* job, bool destroy) {
+                    T* func = *reinterpret_cast<T**>(job->m_storage);
+                    if (destroy) {
+                        func->~T();
+                        std::pmr::polymorphic_allocator<T>(job->m_mr).deallocate(func, 1);
+                    }
+                    else (*func)();
+                };
+            }
+        }
+
+        void clear_function() noexcept {    //destroy the callable and its captures
+            if (m_invoke != nullptr) {
+                m_invoke(this, true);
+                m_invoke = nullptr;
+            }
+        }
+
+        bool has_function() noexcept { return m_invoke != nullptr; };
+
         bool resume() noexcept {    //work is to call the function
             m_children = 1;         //job is its own child, so set to 1
-            m_function();           //run the function, can schedule more children here
+            m_invoke(this, false);  //run the function, can schedule more children here
             return true;
         }
 
+        int32_t type() noexcept { return m_type; };
+        int32_t id() noexcept { return m_id; };
+
         bool deallocate() noexcept { return true; };  //assert this is a job so it has been created by the job system
     };
 
+    static_assert(sizeof(Job_base) + sizeof(void*) + 16 <= c_cache_line_size, "Job header, invoke pointer and small captures must fit into one cache line");
+    static_assert(sizeof(Job) == 2 * c_cache_line_size, "Job must occupy exactly two cache lines");
+
 
     /**
     * \brief Deallocate a Job instance.
@@ -166,21 +279,220 @@ namespace vgjs {
     }
 
 
+    /**
+    * \brief Cheap timestamps for tracing.
+    *
+    * now() reads the time stamp counter on x86, and a raw monotonic clock elsewhere. Ticks
+    * are converted to nanoseconds only when a trace is written, using a factor measured
+    * once by calibrate() against the high resolution clock.
+    */
+    class TraceClock {
+        uint64_t    m_tick0 = 0;                                        ///<ticks at calibration
+        std::chrono::high_resolution_clock::time_point m_time0;         ///<time at calibration
+        double      m_ns_per_tick = 1.0;                                ///<length of a tick
+        bool        m_calibrated = false;
+
+    public:
+        /**
+        * \brief Read the clock.
+        * \returns the current time in ticks.
+        */
+        static uint64_t now() noexcept {
+        #if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+        #elif defined(__linux__)
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        #else
+            return std::chrono::steady_clock::now().time_since_epoch().count();
+        #endif
+        }
+
+        /**
+        * \brief Measure the length of a tick by spinning for the given time.
+        * \param[in] duration Time to spin.
+        */
+        void calibrate(std::chrono::microseconds duration = std::chrono::microseconds(10000)) noexcept {
+            m_time0 = std::chrono::high_resolution_clock::now();
+            m_tick0 = now();
+            auto t1 = m_time0;
+            while (t1 - m_time0 < duration) { t1 = std::chrono::high_resolution_clock::now(); }
+            uint64_t tick1 = now();
+            m_ns_per_tick = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - m_time0).count() / std::max(tick1 - m_tick0, (uint64_t)1);
+            m_calibrated = true;
+        }
+
+        bool    is_calibrated() noexcept { return m_calibrated; };
+        double  ns_per_tick() noexcept { return m_ns_per_tick; };
+
+        /**
+        * \brief Convert a tick count to nanoseconds since a given time point.
+        * \param[in] tick The tick count.
+        * \param[in] start The time point, e.g. the start of the job system.
+        * \returns the nanoseconds from start to tick.
+        */
+        double to_ns(uint64_t tick, std::chrono::high_resolution_clock::time_point start) noexcept {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(m_time0 - start).count() 
+                + (double)(int64_t)(tick - m_tick0) * m_ns_per_tick;
+        }
+    };
+
+
     /**
     * \brief Data structure storing times when jobs where called and ended.
     * Can be saved to a log file and loaded into Google Chrom about:://tracing.
     */
     struct JobLog {
-        std::chrono::high_resolution_clock::time_point m_t1, m_t2;	///< execution start and end
-        uint32_t        m_exec_thread;
-        bool			m_finished;
-        int32_t	        m_type;
-        int32_t	        m_id;
-
-        JobLog(std::chrono::high_resolution_clock::time_point& t1, std::chrono::high_resolution_clock::time_point& t2,
-            int32_t exec_thread, bool finished, int32_t type, int32_t id)
-                : m_t1(t1), m_t2(t2), m_exec_thread(exec_thread), m_finished(finished), m_type(type), m_id(id) {
-        };
+        static const uint8_t c_run = 0;             ///<a job ran from m_t1 to m_t2
+        static const uint8_t c_flow_start = 1;      ///<an arrow with id m_t2 starts at m_t1, e.g. a job scheduled a child
+        static const uint8_t c_flow_end = 2;        ///<the arrow with id m_t2 ends at m_t1, e.g. the child starts
+        static const uint8_t c_coro_begin = 3;      ///<the coro with id m_t2 runs for the first time at m_t1
+        static const uint8_t c_coro_suspend = 4;    ///<the coro with id m_t2 suspends at m_t1
+        static const uint8_t c_coro_resume = 5;     ///<the coro with id m_t2 resumes at m_t1
+        static const uint8_t c_coro_end = 6;        ///<the coro with id m_t2 finishes at m_t1
+        static const uint8_t c_lock = 7;            ///<queue m_type (0 local, 1 global, 2 recycle) of this thread spun m_t2 ticks on its lock, m_id times, before m_t1
+
+        uint64_t        m_t1 = 0, m_t2 = 0;     ///< execution start and end in TraceClock ticks
+        uint32_t        m_exec_thread = 0;
+        bool			m_finished = false;
+        uint8_t         m_kind = c_run;         ///< run, flow or coro event
+        int32_t	        m_type = -1;
+        int32_t	        m_id = -1;
+    };
+
+
+    /**
+    * \brief Fixed size ring of JobLogs, written by one worker and read by one reader.
+    *
+    * The events are allocated once by allocate(), before logging is turned on, so recording
+    * never allocates. The owner thread pushes without locks. If the reader falls behind and the 
+    * ring is full, new events are dropped and counted.
+    */
+    class TraceRing {
+        std::pmr::memory_resource*  m_mr;                       ///<used to allocate the events
+        JobLog*                     m_events = nullptr;         ///<c_capacity events
+        alignas(c_cache_line_size) std::atomic<uint64_t> m_head = 0;   ///<next event to write, written by the owner
+        std::atomic<uint64_t>       m_dropped = 0;              ///<events lost because the ring was full
+        alignas(c_cache_line_size) std::atomic<uint64_t> m_tail = 0;   ///<next event to read, written by the reader
+
+    public:
+        static const uint64_t c_capacity = 1 << 16;             ///<number of events, a power of 2
+
+        TraceRing(std::pmr::memory_resource* mr) noexcept : m_mr{ mr } {};
+        TraceRing(const TraceRing& ring) noexcept : m_mr{ ring.m_mr } {};  //a fresh ring with the same resource
+
+        ~TraceRing() noexcept {
+            if (m_events != nullptr) {
+                m_mr->deallocate(m_events, c_capacity * sizeof(JobLog), alignof(JobLog));
+            }
+        }
+
+        void allocate() noexcept {      ///<call before logging starts
+            if (m_events == nullptr) {
+                m_events = (JobLog*)m_mr->allocate(c_capacity * sizeof(JobLog), alignof(JobLog));
+            }
+        }
+
+        /**
+        * \brief Append an event, called only by the owner thread.
+        * \param[in] ev The event.
+        * \returns false if the event was dropped.
+        */
+        bool push(const JobLog& ev) noexcept {
+            uint64_t head = m_head.load(std::memory_order::relaxed);
+            if (m_events == nullptr || head - m_tail.load(std::memory_order::acquire) >= c_capacity) {
+                m_dropped.fetch_add(1, std::memory_order::relaxed);
+                return false;
+            }
+            m_events[head & (c_capacity - 1)] = ev;
+            m_head.store(head + 1, std::memory_order::release);
+            return true;
+        }
+
+        /**
+        * \brief Hand all events to a function and remove them, called only by the reader.
+        * \param[in] func Function called for each event.
+        * \returns the number of events.
+        */
+        template<typename F>
+        uint64_t drain(F&& func) {
+            uint64_t tail = m_tail.load(std::memory_order::relaxed);
+            uint64_t head = m_head.load(std::memory_order::acquire);
+            for (uint64_t i = tail; i != head; ++i) {
+                func(m_events[i & (c_capacity - 1)]);
+            }
+            m_tail.store(head, std::memory_order::release);
+            return head - tail;
+        }
+
+        void clear() noexcept {         ///<remove all events, called only by the reader
+            m_tail.store(m_head.load(std::memory_order::acquire), std::memory_order::release);
+        }
+
+        uint64_t size() noexcept { return m_head.load() - m_tail.load(); };     ///<number of events in the ring
+        uint64_t dropped() noexcept { return m_dropped.load(); };               ///<number of dropped events
+    };
+
+
+    /**
+    * \brief Header of a binary trace file written by JobSystem::enable_streaming().
+    *
+    * The header is followed by TraceBlocks. Timestamps are TraceClock ticks, which are converted
+    * to nanoseconds since the start of the job system using the reference tick m_tick.
+    */
+    struct TraceFileHeader {
+        char        m_magic[8] = { 'V', 'G', 'J', 'S', 'T', 'R', 'C', '1' };
+        uint32_t    m_event_size = sizeof(JobLog);  ///<detects files written by a different build
+        uint32_t    m_reserved = 0;
+        uint64_t    m_tick = 0;                     ///<reference tick
+        double      m_ns = 0.0;                     ///<nanoseconds from the start of the job system to m_tick
+        double      m_ns_per_tick = 1.0;            ///<length of a tick
+    };
+
+    /**
+    * \brief A block in a binary trace file.
+    */
+    struct TraceBlock {
+        static const uint32_t c_events = 1;     ///<followed by m_count JobLogs
+        static const uint32_t c_type = 2;       ///<followed by an int32_t type and the m_count chars of its name
+
+        uint32_t    m_tag = c_events;
+        uint32_t    m_count = 0;
+    };
+
+
+    /**
+    * \brief Contention of the spin lock of a job queue.
+    */
+    struct LockStats {
+        uint64_t    m_acquisitions = 0;     ///<times the lock was taken
+        uint64_t    m_contended = 0;        ///<times the lock was taken by another thread at the first try
+        uint64_t    m_spins = 0;            ///<failed test-and-set iterations
+        uint64_t    m_spin_ns = 0;          ///<time spent spinning
+
+        LockStats& operator+=(const LockStats& s) noexcept {
+            m_acquisitions += s.m_acquisitions; m_contended += s.m_contended; m_spins += s.m_spins; m_spin_ns += s.m_spin_ns;
+            return *this;
+        }
+
+        LockStats operator-(const LockStats& s) const noexcept {
+            return { m_acquisitions - s.m_acquisitions, m_contended - s.m_contended, m_spins - s.m_spins, m_spin_ns - s.m_spin_ns };
+        }
+    };
+
+    /**
+    * \brief Lock counters of a job queue, only written while holding the lock, so no read-modify-write is needed.
+    */
+    struct LockCounters {
+        std::atomic<uint64_t>   m_acquisitions = 0;
+        std::atomic<uint64_t>   m_contended = 0;
+        std::atomic<uint64_t>   m_spins = 0;
+        std::atomic<uint64_t>   m_spin_ticks = 0;
+
+        static void add(std::atomic<uint64_t>& counter, uint64_t n = 1) noexcept {
+            counter.store(counter.load(std::memory_order::relaxed) + n, std::memory_order::relaxed);
+        }
     };
 
 
@@ -197,6 +509,27 @@ namespace vgjs {
         JOB*             m_head = nullptr;	        //points to first entry
         JOB*             m_tail = nullptr;	        //points to last entry
         int32_t          m_size = 0;                 //number of entries in the queue
+        int32_t          m_peak = 0;                 //highest number of entries
+        LockCounters     m_lock_counters;            //contention of m_lock, only counted if c_lock_stats
+
+        /**
+        * \brief Acquire the lock. Only if the first try fails, the spinning is timed.
+        */
+        void lock() noexcept {
+            if (!m_lock.test_and_set(std::memory_order::acquire)) {
+                if constexpr (c_lock_stats) LockCounters::add(m_lock_counters.m_acquisitions);
+                return;
+            }
+            uint64_t t1 = c_lock_stats ? TraceClock::now() : 0;
+            uint64_t spins = 1;
+            while (m_lock.test_and_set(std::memory_order::acquire)) ++spins;
+            if constexpr (c_lock_stats) {
+                LockCounters::add(m_lock_counters.m_acquisitions);
+                LockCounters::add(m_lock_counters.m_contended);
+                LockCounters::add(m_lock_counters.m_spins, spins);
+                LockCounters::add(m_lock_counters.m_spin_ticks, TraceClock::now() - t1);
+            }
+        }
 
     public:
 
@@ -213,7 +546,7 @@ namespace vgjs {
             uint32_t res = m_size;
             JOB* job = pop();                   //deallocate jobs that run a function
             while (job != nullptr) {            //because they were allocated by the JobSystem
-                auto da = job->get_deallocator(); //get deallocator
+                auto& da = job->get_deallocator(); //get deallocator
                 da.deallocate(job);             //deallocate the memory
                 job = pop();                    //get next entry
             }
@@ -230,12 +563,31 @@ namespace vgjs {
             return m_size;
         }
 
+        /**
+        * \brief Get the highest number of jobs that were in the queue at once.
+        * \returns the high-water mark of the queue.
+        */
+        uint32_t peak() {
+            return m_peak;
+        }
+
+        /**
+        * \brief Get the contention of the queue lock, counted only if VGJS_LOCK_STATS is 1.
+        * \param[in] ns_per_tick Length of a TraceClock tick.
+        * \returns the lock statistics.
+        */
+        LockStats lock_stats(double ns_per_tick) {
+            return { m_lock_counters.m_acquisitions.load(std::memory_order::relaxed), m_lock_counters.m_contended.load(std::memory_order::relaxed),
+                     m_lock_counters.m_spins.load(std::memory_order::relaxed), 
+                     (uint64_t)(m_lock_counters.m_spin_ticks.load(std::memory_order::relaxed) * ns_per_tick) };
+        }
+
         /**
         * \brief Pushes a job onto the queue tail.
         * \param[in] job The job to be pushed into the queue.
         */
         void push(JOB* job) {
-            while (m_lock.test_and_set(std::memory_order::acquire));  // acquire lock
+            lock();
 
             job->m_next = nullptr;      //clear pointer to successor
             if (m_head == nullptr) {    //if queue is empty
@@ -250,6 +602,7 @@ namespace vgjs {
             }
 
             m_size++;                   //increase size
+            if (m_size > m_peak) m_peak = m_size;   //remember high-water mark
             m_lock.clear(std::memory_order::release); //release lock
         };
 
@@ -260,7 +613,7 @@ namespace vgjs {
         JOB* pop() {
             if (m_head == nullptr) return nullptr;
 
-            while (m_lock.test_and_set(std::memory_order::acquire));  // acquire lock
+            lock();
 
             JOB* head = m_head;
             if (head != nullptr) {              //if there is a job at the head of the queue
@@ -279,143 +632,874 @@ namespace vgjs {
 
 
     /**
-    * \brief The main JobSystem class manages the whole VGJS job system.
-    *
-    * The JobSystem starts N threads and provides them with data structures.
-    * It can add new jobs, and wait until they are done.
+    * \brief Singly linked list of retired Jobs, only used by the thread that owns it.
     */
-    class JobSystem {
-        const uint32_t                              c_queue_capacity = 100; ///<save at most N Jobs for recycling
-
-    private:
-        std::pmr::memory_resource*                  m_mr;                   ///<use to allocate/deallocate Jobs
-        std::vector<std::thread>	                m_threads;	            ///<array of thread structures
-        std::atomic<uint32_t>   		            m_thread_count = 0;     ///<number of threads in the pool
-        std::atomic<bool>                           m_terminated = false;   ///<flag set true when the last thread has exited
-        uint32_t									m_start_idx = 0;        ///<idx of first thread that is created
-        static inline thread_local  int32_t		    m_thread_index = -1;    ///<each thread has its own number
-        std::atomic<bool>							m_terminate = false;	///<Flag for terminating the pool
-        static inline thread_local Job_base*        m_current_job = nullptr;///<Pointer to the current job of this thread0
-        std::vector<JobQueue<Job_base>>             m_global_queues;	    ///<each thread has its own Job queue, multiple produce, single consume
-        std::vector<JobQueue<Job_base>>             m_local_queues;	        ///<each thread has its own Job queue, multiple produce, single consume
-        JobQueue<Job>                               m_recycle;              ///<save old jobs for recycling
-        JobQueue<Job>                               m_delete;               ///<save old jobs for recycling
-        std::pmr::vector<std::pmr::vector<JobLog>>	m_logs;				    ///< log the start and stop times of jobs
-        bool                                        m_logging = false;      ///< if true then jobs will be logged
-        std::map<int32_t, std::string>              m_types;                ///<map types to a string for logging
-        std::chrono::time_point<std::chrono::high_resolution_clock> m_start_time = std::chrono::high_resolution_clock::now();	//time when program started
+    struct RetireList {
+        Job*        m_head = nullptr;   ///<first job in the list
+        uint32_t    m_size = 0;         ///<number of jobs in the list
+
+        void push(Job* job) noexcept {
+            job->m_next = m_head;
+            m_head = job;
+            ++m_size;
+        }
 
-        /**
-        * \brief Allocate a job so that it can be scheduled.
-        * 
-        * If there is a job in the recycle queue we use this. Else a new
-        * new Job struct is allocated from the memory resource m_mr.
-        * 
-        * \returns a pointer to the job.
-        */
-        Job* allocate_job() {
-            Job* job = m_recycle.pop();                                //try recycle queue
-            if (job == nullptr ) {                                     //none found
-                std::pmr::polymorphic_allocator<Job> allocator(m_mr);  //use this allocator
-                job = allocator.allocate(1);                           //allocate the object
-                if (job == nullptr) {
-                    std::cout << "No job available\n";
-                    std::terminate();
-                }
-                new (job) Job();                     //call constructor
-                job->m_mr = m_mr;                    //save memory resource for deallocation
-            }
-            else {                                  //job found
-                job->reset();                       //reset it
+        Job* pop() noexcept {
+            Job* job = m_head;
+            if (job != nullptr) {
+                m_head = (Job*)job->m_next;
+                --m_size;
             }
             return job;
         }
+    };
 
-        /**
-        * \brief Allocate a job so that it can be scheduled.
-        * \param[in] f Function that should be executed by the job.
-        * \returns a pointer to the Job.
-        */
-        Job* allocate_job( Function&& f) noexcept {
-            Job* job            = allocate_job();
-            job->m_function     = std::move(f.m_function);    //move the job
-            if (!job->m_function) {
-                std::cout << "Empty function\n";
-                std::terminate();
-            }
-            job->m_thread_index = f.m_thread_index;
-            job->m_type         = f.m_type;
-            job->m_id           = f.m_id;
-            return job;
+
+    /**
+    * \brief Histogram of queue wait times in TraceClock ticks, with logarithmic buckets.
+    *
+    * Each power of two is split into c_sub buckets, so a percentile is off by less than 1/c_sub.
+    * Only the owner thread records, other threads read the counts for reports.
+    */
+    struct LatencyHistogram {
+        static const uint32_t c_sub_bits = 2;                       ///<log2 of buckets per power of two
+        static const uint32_t c_sub = 1 << c_sub_bits;              ///<buckets per power of two
+        static const uint32_t c_buckets = (32 - c_sub_bits + 1) * c_sub;  ///<covers all 32 bit values
+
+        std::atomic<uint64_t> m_counts[c_buckets];
+
+        LatencyHistogram() noexcept { clear(); };
+
+        static uint32_t bucket(uint32_t ticks) noexcept {       ///<bucket of a value
+            if (ticks < c_sub) return ticks;
+            uint32_t msb = 31;
+            while ((ticks & (1u << msb)) == 0) --msb;
+            return (msb - c_sub_bits + 1) * c_sub + ((ticks >> (msb - c_sub_bits)) & (c_sub - 1));
+        }
+
+        static double value(uint32_t bucket) noexcept {         ///<middle of a bucket
+            if (bucket < c_sub) return bucket;
+            uint32_t msb = bucket / c_sub - 1 + c_sub_bits;
+            uint64_t width = 1ull << (msb - c_sub_bits);
+            return (double)((1ull << msb) + (bucket % c_sub) * width) + width / 2.0;
+        }
+
+        void record(uint32_t ticks) noexcept {
+            auto& count = m_counts[bucket(ticks)];
+            count.store(count.load(std::memory_order::relaxed) + 1, std::memory_order::relaxed);
+        }
+
+        void add_to(std::vector<uint64_t>& counts) noexcept {   ///<sum up histograms of all threads
+            counts.resize(c_buckets);
+            for (uint32_t i = 0; i < c_buckets; ++i) counts[i] += m_counts[i].load(std::memory_order::relaxed);
         }
 
+        void clear() noexcept {
+            for (auto& count : m_counts) count.store(0, std::memory_order::relaxed);
+        }
+    };
+
+
+    /**
+    * \brief Queue wait percentiles in nanoseconds, see JobSystem::latency_by_type() and latency_by_queue().
+    */
+    struct LatencyStats {
+        uint64_t    m_count = 0;        ///<number of jobs
+        double      m_p50_ns = 0.0;
+        double      m_p99_ns = 0.0;
+        double      m_p999_ns = 0.0;
+    };
+
+
+    /**
+    * \brief Queue wait histograms of a worker thread, per job type and per queue the job came from.
+    *
+    * The histograms are allocated by allocate() before logging is turned on, so recording never
+    * allocates. Types 0 to c_max_types-1 have their own histogram, all other types share one.
+    */
+    class LatencyRecorder {
     public:
+        static const int32_t    c_max_types = 32;   ///<types with their own histogram
+        static const uint32_t   c_local = 0;        ///<job was taken from the local queue
+        static const uint32_t   c_global = 1;       ///<job was taken from the own global queue
+        static const uint32_t   c_stolen = 2;       ///<job was stolen from another thread
+        static const uint32_t   c_queues = 3;
 
-        /**
-        * \brief JobSystem class constructor.
-        * \param[in] threadCount Number of threads in the system.
-        * \param[in] start_idx Number of first thread, if 1 then the main thread should enter as thread 0.
-        * \param[in] mr The memory resource to use for allocating Jobs.
-        */
-        JobSystem(uint32_t threadCount = 0, uint32_t start_idx = 0, std::pmr::memory_resource *mr = std::pmr::new_delete_resource() ) noexcept
-            : m_mr(mr) { 
+    private:
+        std::pmr::memory_resource*  m_mr;
+        LatencyHistogram*           m_histograms = nullptr;    ///<c_max_types + 1 types, then c_queues queues
 
-            m_start_idx = start_idx;
-            m_thread_count = threadCount;
-            if (m_thread_count == 0) {
-                m_thread_count = std::thread::hardware_concurrency();		///< main thread is also running
-            }
-            if (m_thread_count == 0) {
-                m_thread_count = 1;
-            }
+    public:
+        LatencyRecorder(std::pmr::memory_resource* mr) noexcept : m_mr{ mr } {};
+        LatencyRecorder(const LatencyRecorder& recorder) noexcept : m_mr{ recorder.m_mr } {};  //a fresh recorder with the same resource
 
-            for (uint32_t i = 0; i < m_thread_count; i++) {
-                m_global_queues.push_back(JobQueue<Job_base>());     //global job queue
-                m_local_queues.push_back(JobQueue<Job_base>());     //local job queue
+        ~LatencyRecorder() noexcept {
+            if (m_histograms != nullptr) {
+                std::pmr::polymorphic_allocator<LatencyHistogram>(m_mr).deallocate(m_histograms, c_max_types + 1 + c_queues);
             }
+        }
 
-            for (uint32_t i = start_idx; i < m_thread_count; i++) {
-                std::cout << "Starting thread " << i << std::endl;
-                m_threads.push_back(std::thread(&JobSystem::thread_task, this, i));	//spawn the pool threads
-                m_threads[i].detach();
+        void allocate() noexcept {      ///<call before logging starts
+            if (m_histograms == nullptr) {
+                auto histograms = std::pmr::polymorphic_allocator<LatencyHistogram>(m_mr).allocate(c_max_types + 1 + c_queues);
+                for (uint32_t i = 0; i < c_max_types + 1 + c_queues; ++i) new (&histograms[i]) LatencyHistogram();
+                m_histograms = histograms;
             }
+        }
 
-            m_logs.resize(m_thread_count, std::pmr::vector<JobLog>{mr});    //make room for the log files
-        };
+        LatencyHistogram* type(int32_t type) noexcept {     ///<histogram of a type, or nullptr
+            if (m_histograms == nullptr) return nullptr;
+            return &m_histograms[type >= 0 && type < c_max_types ? type : c_max_types];
+        }
 
-        /**
-        * \brief Singleton access through class.
-        * \param[in] threadCount Number of threads in the system.
-        * \param[in] start_idx Number of first thread, if 1 then the main thread should enter as thread 0.
-        * \param[in] mr The memory resource to use for allocating Jobs.
-        * \returns a pointer to the JobSystem instance.
-        */
-        static JobSystem& instance(uint32_t threadCount = 0, uint32_t start_idx = 0, std::pmr::memory_resource* mr = std::pmr::new_delete_resource()) noexcept {
-            static JobSystem instance(threadCount, start_idx, mr); //thread safe init guaranteed - Meyer's Singleton
-            return instance;
-        };
+        LatencyHistogram* queue(uint32_t queue) noexcept {  ///<histogram of a queue, or nullptr
+            if (m_histograms == nullptr) return nullptr;
+            return &m_histograms[c_max_types + 1 + queue];
+        }
 
-        /**
-        * \brief Test whether the job system has been started yet.
-        * \returns true if the instance exists, else false.
-        */
-        static bool is_instance_created() noexcept {
-            return m_thread_index >= 0;
-        };
+        void record(int32_t type, uint32_t queue, uint32_t ticks) noexcept {    ///<called only by the owner
+            if (m_histograms == nullptr) return;
+            this->type(type)->record(ticks);
+            this->queue(queue)->record(ticks);
+        }
 
-        JobSystem(const JobSystem&) = delete;				// non-copyable,
-        JobSystem& operator=(const JobSystem&) = delete;
-        JobSystem(JobSystem&&) = default;					// but movable
-        JobSystem& operator=(JobSystem&&) = default;
+        void clear() noexcept {
+            if (m_histograms == nullptr) return;
+            for (uint32_t i = 0; i < c_max_types + 1 + c_queues; ++i) m_histograms[i].clear();
+        }
+    };
 
-        /**
-        * \brief JobSystem class destructor.
-        *
+
+    /**
+    * \brief Selects the jobs that are traced while logging is on, see JobSystem::set_trace_filter().
+    *
+    * A job is traced if its type and its thread are selected, it is one of the sampled jobs of its
+    * thread, and it ran for at least the minimum duration. Queue wait times are recorded for all jobs.
+    */
+    struct TraceFilter {
+        static const int32_t c_max_types = 64;      ///<types 0 to c_max_types-1 can be selected one by one
+
+        uint64_t                m_types = ~0ull;        ///<bit t is set if jobs of type t are traced
+        bool                    m_other_types = true;   ///<trace jobs without a type, or with a type >= c_max_types
+        std::vector<uint32_t>   m_threads;              ///<indices of the traced threads, empty means all
+        uint32_t                m_sample = 1;           ///<trace 1 in m_sample jobs of each thread
+        double                  m_min_us = 0.0;         ///<trace only jobs running at least this long
+
+        TraceFilter& only_types(std::initializer_list<int32_t> types) noexcept {    ///<trace only jobs of these types
+            m_types = 0;
+            m_other_types = false;
+            for (auto type : types) {
+                if (type >= 0 && type < c_max_types) m_types |= 1ull << type;
+                else m_other_types = true;
+            }
+            return *this;
+        }
+    };
+
+    /**
+    * \brief The trace filter as seen by one worker thread, so that the check per job only reads
+    * members of the worker.
+    */
+    class TraceSampler {
+        uint64_t    m_types = ~0ull;
+        bool        m_other_types = true;
+        bool        m_thread = true;        //this thread is traced
+        uint32_t    m_sample = 1;
+        uint32_t    m_count = 0;            //jobs since the last sampled one
+        uint64_t    m_min_ticks = 0;
+
+    public:
+        void set(const TraceFilter& filter, uint32_t thread, double ns_per_tick) noexcept {  ///<call while logging is off
+            m_types = filter.m_types;
+            m_other_types = filter.m_other_types;
+            m_thread = filter.m_threads.empty() || std::find(filter.m_threads.begin(), filter.m_threads.end(), thread) != filter.m_threads.end();
+            m_sample = std::max(filter.m_sample, 1u);
+            m_count = 0;
+            m_min_ticks = (uint64_t)(filter.m_min_us * 1000.0 / ns_per_tick);
+        }
+
+        bool select(int32_t type) noexcept {    ///<decide at the start of a job, called only by the owner
+            if (!m_thread) return false;
+            if (type >= 0 && type < TraceFilter::c_max_types ? ((m_types >> type) & 1) == 0 : !m_other_types) return false;
+            if (++m_count < m_sample) return false;
+            m_count = 0;
+            return true;
+        }
+
+        bool keep(uint64_t ticks) const noexcept {  ///<decide at the end of a selected job
+            return ticks >= m_min_ticks;
+        }
+    };
+
+
+    /**
+    * \brief A job on the critical path, see compute_critical_path().
+    */
+    struct CriticalPathJob {
+        int32_t     m_type = -1;
+        int32_t     m_id = -1;
+        uint32_t    m_thread = 0;       ///<thread that ran the job
+        uint64_t    m_start = 0;        ///<start tick
+        double      m_ns = 0.0;         ///<time the job adds to the path, until it scheduled the next job on the path
+    };
+
+    /**
+    * \brief Result of compute_critical_path().
+    */
+    struct CriticalPath {
+        double                                  m_work_ns = 0.0;    ///<sum of the durations of all jobs
+        double                                  m_span_ns = 0.0;    ///<length of the longest chain of dependent jobs
+        uint64_t                                m_num_jobs = 0;     ///<number of jobs in the trace
+        std::vector<CriticalPathJob>            m_path;             ///<the jobs on the critical path, in order
+        std::vector<std::pair<int32_t, double>> m_types;            ///<time on the path per type, longest first
+
+        double parallelism() const noexcept { return m_span_ns > 0.0 ? m_work_ns / m_span_ns : 0.0; };  ///<upper bound for the speedup
+    };
+
+    /**
+    * \brief Compute the critical path of the jobs in a trace.
+    *
+    * The nodes are the job runs, the edges are the flow arrows: a job scheduling a child or a continuation,
+    * the last child resuming a coro, and a coro resuming after a suspension. A job can start only after the
+    * part of its predecessor up to the point where it was scheduled, so the path length of a job is the 
+    * longest path to such a point plus its own duration. Jobs are visited in order of their start times,
+    * since an arrow never points back in time.
+    *
+    * \param[in] events Job runs and flow events, e.g. from the trace rings or a binary trace file.
+    * \param[in] ns_per_tick Length of a tick.
+    * \returns the work, the span and the jobs on the critical path.
+    */
+    inline CriticalPath compute_critical_path(std::vector<JobLog>& events, double ns_per_tick) {
+        struct Node {
+            JobLog*     m_run;
+            double      m_start_len = 0.0;      //longest path up to the start of this job, in ticks
+            int64_t     m_pred = -1;            //predecessor on that path
+            uint64_t    m_pred_tick = 0;        //tick in the predecessor where this job was scheduled
+        };
+
+        CriticalPath result;
+        std::vector<Node> nodes;
+        std::vector<JobLog*> flows;
+        for (auto& ev : events) {
+            if (ev.m_kind == JobLog::c_run && ev.m_t2 >= ev.m_t1) nodes.push_back({ &ev });
+            else if (ev.m_kind == JobLog::c_flow_start || ev.m_kind == JobLog::c_flow_end) flows.push_back(&ev);
+        }
+        std::sort(nodes.begin(), nodes.end(), [](auto& a, auto& b) { return a.m_run->m_t1 < b.m_run->m_t1; });
+        std::sort(flows.begin(), flows.end(), [](auto* a, auto* b) {   //starts before ends at the same tick
+            return a->m_t1 != b->m_t1 ? a->m_t1 < b->m_t1 : a->m_kind < b->m_kind; });
+
+        std::map<uint32_t, std::vector<int64_t>> threads;   //runs of each thread, sorted by start
+        for (int64_t i = 0; i < (int64_t)nodes.size(); ++i) {
+            threads[nodes[i].m_run->m_exec_thread].push_back(i);
+            result.m_work_ns += (nodes[i].m_run->m_t2 - nodes[i].m_run->m_t1) * ns_per_tick;
+        }
+        result.m_num_jobs = nodes.size();
+
+        auto find = [&](JobLog* ev) -> int64_t {            //the run of the same thread containing the event
+            auto& runs = threads[ev->m_exec_thread];
+            auto it = std::upper_bound(runs.begin(), runs.end(), ev->m_t1, [&](uint64_t t, int64_t n) { return t < nodes[n].m_run->m_t1; });
+            if (it == runs.begin()) return -1;
+            --it;
+            return ev->m_t1 <= nodes[*it].m_run->m_t2 ? *it : -1;
+        };
+
+        std::map<uint64_t, std::pair<int64_t, uint64_t>> open;    //arrow id -> source run and tick
+        std::vector<std::vector<std::pair<int64_t, uint64_t>>> preds(nodes.size());
+        for (auto* ev : flows) {
+            if (ev->m_kind == JobLog::c_flow_start) {
+                int64_t n = find(ev);
+                if (n >= 0) open[ev->m_t2] = { n, ev->m_t1 };
+            }
+            else {
+                auto it = open.find(ev->m_t2);
+                if (it == open.end()) continue;
+                int64_t n = find(ev);
+                if (n >= 0 && n != it->second.first) preds[n].push_back(it->second);
+                open.erase(it);
+            }
+        }
+
+        int64_t last = -1;
+        double span = 0.0;
+        for (int64_t i = 0; i < (int64_t)nodes.size(); ++i) {
+            Node& node = nodes[i];
+            for (auto& [p, tick] : preds[i]) {
+                double len = nodes[p].m_start_len + (double)(tick - nodes[p].m_run->m_t1);
+                if (len > node.m_start_len || node.m_pred < 0) {
+                    node.m_start_len = std::max(len, node.m_start_len);
+                    node.m_pred = p;
+                    node.m_pred_tick = tick;
+                }
+            }
+            double end = node.m_start_len + (double)(node.m_run->m_t2 - node.m_run->m_t1);
+            if (end > span) { span = end; last = i; }
+        }
+        result.m_span_ns = span * ns_per_tick;
+
+        std::map<int32_t, double> types;
+        uint64_t until = last >= 0 ? nodes[last].m_run->m_t2 : 0;
+        for (int64_t n = last; n >= 0; n = nodes[n].m_pred) {   //walk back along the path
+            JobLog* run = nodes[n].m_run;
+            double ns = (until - run->m_t1) * ns_per_tick;
+            result.m_path.push_back({ run->m_type, run->m_id, run->m_exec_thread, run->m_t1, ns });
+            types[run->m_type] += ns;
+            until = nodes[n].m_pred_tick;
+        }
+        std::reverse(result.m_path.begin(), result.m_path.end());
+        result.m_types.assign(types.begin(), types.end());
+        std::sort(result.m_types.begin(), result.m_types.end(), [](auto& a, auto& b) { return a.second > b.second; });
+        return result;
+    }
+
+
+    /**
+    * \brief Snapshot of the counters of one worker thread, see JobSystem::stats().
+    *
+    * Times are in nanoseconds. Peaks are the highest queue sizes since the start, they are
+    * not subtracted by operator-, but combined with max by operator+=.
+    */
+    struct JobStats {
+        uint64_t    m_jobs = 0;             ///<functions run
+        uint64_t    m_coros = 0;            ///<coro resumptions
+        uint64_t    m_local_pops = 0;       ///<jobs taken from the local queue
+        uint64_t    m_global_pops = 0;      ///<jobs taken from the own global queue
+        uint64_t    m_steal_attempts = 0;   ///<tries to take a job from the global queue of another thread
+        uint64_t    m_steals = 0;           ///<successful tries
+        uint64_t    m_idle_loops = 0;       ///<loops that found no job
+        uint64_t    m_busy_ns = 0;          ///<time spent running jobs
+        uint64_t    m_idle_ns = 0;          ///<time spent looking for jobs
+        uint64_t    m_allocations = 0;      ///<Jobs allocated from the memory resource
+        uint64_t    m_recycled = 0;         ///<Jobs taken from the recycle queue
+        uint64_t    m_local_peak = 0;       ///<highest size of the local queue
+        uint64_t    m_global_peak = 0;      ///<highest size of the global queue
+        LockStats   m_local_lock;           ///<contention of the local queue, if VGJS_LOCK_STATS is 1
+        LockStats   m_global_lock;          ///<contention of the global queue
+        LockStats   m_recycle_lock;         ///<contention of the recycle queue
+
+        JobStats& operator+=(const JobStats& s) noexcept {
+            m_jobs += s.m_jobs; m_coros += s.m_coros; m_local_pops += s.m_local_pops; m_global_pops += s.m_global_pops;
+            m_steal_attempts += s.m_steal_attempts; m_steals += s.m_steals; m_idle_loops += s.m_idle_loops;
+            m_busy_ns += s.m_busy_ns; m_idle_ns += s.m_idle_ns; m_allocations += s.m_allocations; m_recycled += s.m_recycled;
+            m_local_peak = std::max(m_local_peak, s.m_local_peak); m_global_peak = std::max(m_global_peak, s.m_global_peak);
+            m_local_lock += s.m_local_lock; m_global_lock += s.m_global_lock; m_recycle_lock += s.m_recycle_lock;
+            return *this;
+        }
+
+        JobStats operator-(const JobStats& s) const noexcept {
+            JobStats d = *this;
+            d.m_jobs -= s.m_jobs; d.m_coros -= s.m_coros; d.m_local_pops -= s.m_local_pops; d.m_global_pops -= s.m_global_pops;
+            d.m_steal_attempts -= s.m_steal_attempts; d.m_steals -= s.m_steals; d.m_idle_loops -= s.m_idle_loops;
+            d.m_busy_ns -= s.m_busy_ns; d.m_idle_ns -= s.m_idle_ns; d.m_allocations -= s.m_allocations; d.m_recycled -= s.m_recycled;
+            d.m_local_lock = m_local_lock - s.m_local_lock; d.m_global_lock = m_global_lock - s.m_global_lock; d.m_recycle_lock = m_recycle_lock - s.m_recycle_lock;
+            return d;
+        }
+    };
+
+
+    /**
+    * \brief Always-on counters of a worker thread, written only by the owner and read by JobSystem::stats().
+    */
+    struct JobCounters {
+        std::atomic<uint64_t>   m_jobs = 0;
+        std::atomic<uint64_t>   m_coros = 0;
+        std::atomic<uint64_t>   m_local_pops = 0;
+        std::atomic<uint64_t>   m_global_pops = 0;
+        std::atomic<uint64_t>   m_steal_attempts = 0;
+        std::atomic<uint64_t>   m_steals = 0;
+        std::atomic<uint64_t>   m_idle_loops = 0;
+        std::atomic<uint64_t>   m_busy_ticks = 0;
+        std::atomic<uint64_t>   m_idle_ticks = 0;
+        std::atomic<uint64_t>   m_allocations = 0;
+        std::atomic<uint64_t>   m_recycled = 0;
+
+        /**
+        * \brief Increase a counter. There is only one writer, so no read-modify-write instruction is needed.
+        * \param[in] counter The counter.
+        * \param[in] n The increment.
+        */
+        static void add(std::atomic<uint64_t>& counter, uint64_t n = 1) noexcept {
+            counter.store(counter.load(std::memory_order::relaxed) + n, std::memory_order::relaxed);
+        }
+    };
+
+
+    /**
+    * \brief Per-thread state of the job system.
+    *
+    * Everything a worker thread touches in its main loop is gathered here. Each queue
+    * starts on its own cache line, and the data that only the owner thread writes sits
+    * on a line of its own, so neighboring workers never false share.
+    */
+    struct alignas(c_cache_line_size) JobWorker {
+        struct LockSample {
+            uint64_t    m_spin_ticks = 0;
+            uint64_t    m_contended = 0;
+            bool        m_active = false;       ///<there was contention in the last interval
+        };
+
+        alignas(c_cache_line_size) JobQueue<Job_base>   m_local_queue;      ///<jobs that must run on this thread, multiple produce, single consume
+        alignas(c_cache_line_size) JobQueue<Job_base>   m_global_queue;     ///<jobs that can run on any thread, multiple produce, multiple consume
+        alignas(c_cache_line_size) JobQueue<Job>        m_recycle;          ///<old jobs freed by this thread, kept for recycling
+        alignas(c_cache_line_size) uint32_t             m_random = 1;       ///<state of the random number generator
+        uint32_t                                        m_next = 0;         ///<next queue to steal a job from
+        uint32_t                                        m_noop = 0;         ///<number of loops until logging the lock counters
+        uint32_t                                        m_transfers = 0;    ///<coros resumed by symmetric transfer during the current job
+        RetireList                                      m_reclaim;          ///<retired jobs, freed in batches
+        std::atomic<std::size_t>                        m_retired = 0;      ///<number of retired jobs not freed yet, only written by this thread
+        std::atomic<std::size_t>                        m_retired_peak = 0; ///<highest number of retired jobs, only written by this thread
+        uint64_t                                        m_slice_start = 0;  ///<tick when the current or last job started
+        uint64_t                                        m_slice_end = 0;    ///<tick when the last job ended, 0 while a job runs
+        uint64_t                                        m_lock_sample = 0;  ///<tick when the queue locks were last logged
+        std::array<LockSample, 3>                       m_lock_last{};      ///<lock counters of the queues when last logged
+        TraceRing                                       m_log;              ///<log the start and stop times of jobs
+        LatencyRecorder                                 m_latency;          ///<queue wait times of the jobs
+        TraceSampler                                    m_sampler;          ///<selects the traced jobs
+        bool                                            m_traced = false;   ///<the current job is traced
+        alignas(c_cache_line_size) JobCounters          m_counters;         ///<statistics, read by other threads
+
+        JobWorker(std::pmr::memory_resource* mr) noexcept : m_log{ mr }, m_latency{ mr } {};
+        JobWorker(const JobWorker& worker) noexcept : m_log{ worker.m_log }, m_latency{ worker.m_latency } {};  //a fresh worker with the same log resource
+
+        /**
+        * \brief Get a random number, using xorshift so that no state is shared with other threads.
+        * \returns a random number.
+        */
+        uint32_t random() noexcept {
+            m_random ^= m_random << 13;
+            m_random ^= m_random >> 17;
+            m_random ^= m_random << 5;
+            return m_random;
+        }
+    };
+
+
+    /**
+    * \brief Frame-scoped bump allocator with N buffers that are reset as a whole.
+    *
+    * Each thread bumps a pointer in its own part of the current frame buffer, deallocation
+    * only counts down the number of live allocations. Calling next_frame() at the frame boundary
+    * switches to the next buffer, which is reset in one go if everything allocated in it
+    * has been deallocated. With 2 or 3 buffers, work of the last frames can still run while the
+    * new frame starts. A thread holds the lock of its slot while it allocates, and next_frame() holds
+    * all of them while it resets a buffer, so no allocation can be in flight in a buffer being reset.
+    * Can be used as memory resource of the JobSystem, or for Coros.
+    */
+    class FrameArena : public std::pmr::memory_resource {
+    public:
+        static const uint32_t c_max_buffers = 3;                ///<at most triple buffering
+
+    private:
+        static constexpr std::size_t c_block_size = 1 << 20;        ///<blocks are aligned to this size
+
+        struct Block {                          ///<header at the start of each block
+            Block*      m_next = nullptr;       ///<next block of the same buffer
+            std::size_t m_size = 0;             ///<size of the block
+            uint32_t    m_buffer = 0;           ///<buffer the block belongs to
+        };
+
+        struct Buffer {                         ///<the part of a frame buffer that belongs to one thread
+            Block*                  m_blocks = nullptr;     ///<list of blocks, the first one is in use, large blocks are linked behind it
+            char*                   m_ptr = nullptr;        ///<next free byte
+            char*                   m_end = nullptr;        ///<end of the current block
+            std::atomic<int64_t>    m_live = 0;             ///<allocations minus deallocations of this thread, can be negative
+        };
+
+        struct alignas(c_cache_line_size) Slot {            ///<each thread has its own slot, slot 0 is shared
+            std::atomic_flag    m_lock = ATOMIC_FLAG_INIT;  ///<held while allocating, and by next_frame()
+            Buffer              m_buffers[c_max_buffers];
+        };
+
+        std::pmr::memory_resource*  m_upstream;             ///<blocks come from here
+        uint32_t                    m_num_buffers;          ///<number of frame buffers
+        std::vector<Slot>           m_slots;                ///<slot 0 for foreign threads, slot i+1 for thread i
+        std::atomic<uint64_t>       m_frame = 0;            ///<number of the current frame
+
+        Slot& slot() noexcept;
+        void  release(Buffer& buffer, bool keep) noexcept;
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void  do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+        bool  do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; };
+
+    public:
+        FrameArena(uint32_t thread_count = 0, uint32_t num_buffers = c_max_buffers, 
+                    std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) noexcept;
+        FrameArena(const FrameArena&) = delete;
+        ~FrameArena() noexcept;
+
+        void        next_frame() noexcept;
+        bool        is_drained(uint32_t buffer) noexcept;
+        uint64_t    frame() noexcept { return m_frame.load(); };
+        std::pmr::memory_resource* upstream() noexcept { return m_upstream; };
+    };
+
+
+    /**
+    * \brief Memory resource that carves slabs out of large regions backed by huge pages.
+    *
+    * Regions are reserved from the OS with mmap (MAP_HUGETLB) or VirtualAlloc (MEM_LARGE_PAGES).
+    * If huge pages are not available, regular pages are used, on Linux with a madvise() hint for
+    * transparent huge pages. Allocations of up to c_max_block bytes are served from size classes, 
+    * each class cuts slabs into blocks and keeps a free list guarded by a lightweight lock. 
+    * Larger allocations go to the upstream resource. Regions are given back to the OS only when the 
+    * resource is destroyed. Can be used as memory resource of the JobSystem, or for Coros.
+    */
+    class HugePageResource : public std::pmr::memory_resource {
+        static const std::size_t c_num_classes = 10;                    ///<block sizes 64, 128, ..., 32768 bytes
+        static const std::size_t c_max_block = c_cache_line_size << (c_num_classes - 1); ///<larger blocks go upstream
+        static const std::size_t c_slab_size = 1 << 16;                 ///<a slab is cut into blocks of one class
+        static const std::size_t c_huge_page_size = 1 << 21;            ///<regions are multiples of this size
+
+        struct Block {
+            Block* m_next = nullptr;            ///<next free block, or next region
+        };
+
+        struct alignas(c_cache_line_size) SizeClass {
+            std::atomic_flag    m_lock = ATOMIC_FLAG_INIT;  ///<for locking the free list
+            Block*              m_free = nullptr;           ///<free blocks of this class
+        };
+
+        std::pmr::memory_resource*  m_upstream;             ///<large blocks come from here
+        std::size_t                 m_region_size;          ///<size of a region
+        bool                        m_use_huge_pages;       ///<try to get huge pages
+        bool                        m_huge_pages = false;   ///<true if a region got huge pages
+        SizeClass                   m_classes[c_num_classes];
+        std::atomic_flag            m_region_lock = ATOMIC_FLAG_INIT;  ///<for locking the regions
+        Block*                      m_regions = nullptr;    ///<list of regions, the first block of each region links them
+        char*                       m_region_ptr = nullptr; ///<next free byte in the current region
+        char*                       m_region_end = nullptr; ///<end of the current region
+        std::atomic<std::size_t>    m_reserved = 0;         ///<bytes reserved from the OS
+        std::atomic<std::size_t>    m_in_use = 0;           ///<bytes handed out to users
+
+        /**
+        * \brief Reserve a region from the OS, with huge pages if possible.
+        * \returns a pointer to the region or nullptr.
+        */
+        void* map_region() noexcept {
+            void* ptr = nullptr;
+        #if defined(_WIN32)
+            SIZE_T large = GetLargePageMinimum();
+            if (m_use_huge_pages && large > 0 && m_region_size % large == 0) {  //needs the SeLockMemoryPrivilege
+                ptr = VirtualAlloc(nullptr, m_region_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+                if (ptr != nullptr) m_huge_pages = true;
+            }
+            if (ptr == nullptr) {
+                ptr = VirtualAlloc(nullptr, m_region_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            }
+        #else
+            #if defined(MAP_HUGETLB)
+            if (m_use_huge_pages) {                 //needs reserved huge pages, see /proc/sys/vm/nr_hugepages
+                ptr = mmap(nullptr, m_region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (ptr == MAP_FAILED) ptr = nullptr;
+                else m_huge_pages = true;
+            }
+            #endif
+            if (ptr == nullptr) {                   //fall back to regular pages
+                ptr = mmap(nullptr, m_region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (ptr == MAP_FAILED) return nullptr;
+                #if defined(MADV_HUGEPAGE)
+                if (m_use_huge_pages) madvise(ptr, m_region_size, MADV_HUGEPAGE);  //ask for transparent huge pages
+                #endif
+            }
+        #endif
+            if (ptr != nullptr) m_reserved += m_region_size;
+            return ptr;
+        }
+
+        /**
+        * \brief Give a region back to the OS.
+        * \param[in] ptr Pointer to the region.
+        */
+        void unmap_region(void* ptr) noexcept {
+        #if defined(_WIN32)
+            VirtualFree(ptr, 0, MEM_RELEASE);
+        #else
+            munmap(ptr, m_region_size);
+        #endif
+        }
+
+        /**
+        * \brief Get a new slab from the current region, reserve a new region if it is used up.
+        * \returns a pointer to the slab.
+        */
+        char* allocate_slab() noexcept {
+            while (m_region_lock.test_and_set(std::memory_order::acquire));
+            if (m_region_ptr + c_slab_size > m_region_end) {
+                Block* region = (Block*)map_region();
+                if (region == nullptr) {
+                    m_region_lock.clear(std::memory_order::release);
+                    return nullptr;
+                }
+                region->m_next = m_regions;                 //first cache line links the regions
+                m_regions = region;
+                m_region_ptr = (char*)region + c_cache_line_size;
+                m_region_end = (char*)region + m_region_size;
+            }
+            char* slab = m_region_ptr;
+            m_region_ptr += c_slab_size;
+            m_region_lock.clear(std::memory_order::release);
+            return slab;
+        }
+
+        static std::size_t size_class(std::size_t bytes) noexcept {
+            std::size_t idx = 0;
+            for (std::size_t size = c_cache_line_size; size < bytes; size <<= 1) ++idx;
+            return idx;
+        }
+
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            if (bytes > c_max_block || alignment > c_cache_line_size) {
+                return m_upstream->allocate(bytes, alignment);
+            }
+            auto idx = size_class(bytes);
+            std::size_t size = c_cache_line_size << idx;
+            SizeClass& sc = m_classes[idx];
+
+            while (sc.m_lock.test_and_set(std::memory_order::acquire));
+            Block* block = sc.m_free;
+            if (block == nullptr) {                         //cut a new slab into blocks
+                char* slab = allocate_slab();
+                if (slab == nullptr) {
+                    sc.m_lock.clear(std::memory_order::release);
+                    throw std::bad_alloc{};
+                }
+                for (std::size_t off = c_slab_size; off >= size; off -= size) {
+                    Block* b = (Block*)(slab + off - size);
+                    b->m_next = block;
+                    block = b;
+                }
+            }
+            sc.m_free = block->m_next;
+            sc.m_lock.clear(std::memory_order::release);
+
+            m_in_use.fetch_add(size, std::memory_order::relaxed);
+            return block;
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+            if (bytes > c_max_block || alignment > c_cache_line_size) {
+                m_upstream->deallocate(p, bytes, alignment);
+                return;
+            }
+            auto idx = size_class(bytes);
+            SizeClass& sc = m_classes[idx];
+            Block* block = (Block*)p;
+
+            while (sc.m_lock.test_and_set(std::memory_order::acquire));
+            block->m_next = sc.m_free;
+            sc.m_free = block;
+            sc.m_lock.clear(std::memory_order::release);
+
+            m_in_use.fetch_sub(c_cache_line_size << idx, std::memory_order::relaxed);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        /**
+        * \brief Constructor.
+        * \param[in] region_size Bytes to reserve from the OS at once, rounded up to a multiple of 2 MB.
+        * \param[in] use_huge_pages If true, try to get huge pages.
+        * \param[in] upstream Memory resource for blocks larger than c_max_block.
+        */
+        HugePageResource(std::size_t region_size = 1 << 25, bool use_huge_pages = true,
+                            std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) noexcept
+            : m_upstream(upstream), m_use_huge_pages(use_huge_pages) {
+            m_region_size = std::max((region_size + c_huge_page_size - 1) & ~(c_huge_page_size - 1), c_huge_page_size);
+        };
+
+        HugePageResource(const HugePageResource&) = delete;
+
+        ~HugePageResource() noexcept {
+            while (m_regions != nullptr) {
+                Block* next = m_regions->m_next;
+                unmap_region(m_regions);
+                m_regions = next;
+            }
+        }
+
+        std::size_t reserved() noexcept { return m_reserved.load(); };  ///<bytes reserved from the OS
+        std::size_t in_use() noexcept { return m_in_use.load(); };      ///<bytes currently handed out, without the upstream
+        bool        huge_pages() noexcept { return m_huge_pages; };     ///<true if huge pages were granted
+    };
+
+
+    /**
+    * \brief The main JobSystem class manages the whole VGJS job system.
+    *
+    * The JobSystem starts N threads and provides them with data structures.
+    * It can add new jobs, and wait until they are done.
+    */
+    class JobSystem {
+        const uint32_t                              c_queue_capacity = 100; ///<save at most N Jobs for recycling
+        const uint32_t                              c_reclaim_batch = 16;   ///<free at most N retired Jobs at once
+        const uint32_t                              c_max_transfers = 64;   ///<coros resumed by symmetric transfer before one is scheduled
+
+    private:
+        std::pmr::memory_resource*                  m_mr;                   ///<use to allocate/deallocate Jobs
+        std::vector<std::thread>	                m_threads;	            ///<array of thread structures
+        std::atomic<uint32_t>   		            m_thread_count = 0;     ///<number of threads in the pool
+        std::atomic<uint32_t>                       m_start_counter = 0;    ///<counted down by the threads when they start
+        std::atomic<bool>                           m_terminated = false;   ///<flag set true when the last thread has exited
+        uint32_t									m_start_idx = 0;        ///<idx of first thread that is created
+        static inline thread_local  int32_t		    m_thread_index = -1;    ///<each thread has its own number
+        std::atomic<bool>							m_terminate = false;	///<Flag for terminating the pool
+        static inline thread_local Job_base*        m_current_job = nullptr;///<Pointer to the current job of this thread0
+        static inline std::atomic<JobSystem*>       m_instance = nullptr;   ///<the job system returned by instance()
+        std::vector<JobWorker>                      m_workers;              ///<each thread has its own queues, free list and log
+        bool                                        m_recycle_jobs = true;  ///<false if m_mr is a FrameArena, which frees for free
+        std::atomic<bool>                           m_inline_awaits = false;///<if true, a single awaited child runs on the awaiting thread
+        std::atomic<bool>                           m_logging = false;      ///< if true then jobs will be logged
+        uint64_t                                    m_lock_interval = 0;    ///<ticks between logging the queue locks
+        TraceClock                                  m_clock;                ///<timestamps of the logged jobs
+        std::once_flag                              m_calibrate;            ///<the clock is calibrated once
+        std::atomic<bool>                           m_streaming = false;    ///<if true the trace writer runs
+        std::thread                                 m_trace_writer;         ///<drains the trace rings into m_trace_file
+        std::ofstream                               m_trace_file;           ///<binary trace file
+        std::vector<JobLog>                         m_trace_buffer;         ///<events of one ring, before writing them
+        std::map<int32_t, std::string>              m_types;                ///<map types to a string for logging
+        std::chrono::time_point<std::chrono::high_resolution_clock> m_start_time = std::chrono::high_resolution_clock::now();	//time when program started
+
+        /**
+        * \brief Allocate a job so that it can be scheduled.
+        * 
+        * If there is a job in the recycle queue we use this. Else a new
+        * new Job struct is allocated from the memory resource m_mr.
+        * 
+        * \returns a pointer to the job.
+        */
+        Job* allocate_job() {
+            JobWorker& w = worker();
+            Job* job = w.m_recycle.pop();                              //try recycle queue of this thread
+            if (m_thread_index >= 0) {                                 //only the owner writes its counters
+                JobCounters::add(job == nullptr ? w.m_counters.m_allocations : w.m_counters.m_recycled);
+            }
+            if (job == nullptr ) {                                     //none found
+                std::pmr::polymorphic_allocator<Job> allocator(m_mr);  //use this allocator
+                job = allocator.allocate(1);                           //allocate the object
+                if (job == nullptr) {
+                    std::cout << "No job available\n";
+                    std::terminate();
+                }
+                new (job) Job();                     //call constructor
+                job->m_mr = m_mr;                    //save memory resource for deallocation
+            }
+            else {                                  //job found
+                job->reset();                       //reset it
+            }
+            return job;
+        }
+
+        /**
+        * \brief Allocate a job so that it can be scheduled.
+        * \param[in] f Function that should be executed by the job.
+        * \returns a pointer to the Job.
+        */
+        Job* allocate_job( Function&& f) noexcept {
+            if (!f.m_function) {
+                std::cout << "Empty function\n";
+                std::terminate();
+            }
+            Job* job            = allocate_job();
+            job->set_function(std::move(f.m_function));    //move the function into the job
+            job->m_thread_index = f.m_thread_index;
+            job->m_type         = f.m_type;
+            job->m_id           = f.m_id;
+            return job;
+        }
+
+    public:
+
+        /**
+        * \brief JobSystem class constructor.
+        *
+        * The new job system becomes the one returned by instance(), so schedule() and the coros use it
+        * until it is destroyed. Job systems can thus be created one after the other, e.g. with different
+        * numbers of threads, but only the last one constructed should have jobs at any time.
+        *
+        * \param[in] threadCount Number of threads in the system.
+        * \param[in] start_idx Number of first thread, if 1 then the main thread should enter as thread 0.
+        * \param[in] mr The memory resource to use for allocating Jobs.
+        */
+        JobSystem(uint32_t threadCount = 0, uint32_t start_idx = 0, std::pmr::memory_resource *mr = std::pmr::new_delete_resource() ) noexcept
+            : m_mr(mr) { 
+
+            m_start_idx = start_idx;
+            m_thread_count = threadCount;
+            if (m_thread_count == 0) {
+                m_thread_count = std::thread::hardware_concurrency();		///< main thread is also running
+            }
+            if (m_thread_count == 0) {
+                m_thread_count = 1;
+            }
+
+            m_start_counter = m_thread_count.load();
+
+            FrameArena* arena = dynamic_cast<FrameArena*>(mr);     //jobs from an arena are not recycled
+            m_recycle_jobs = (arena == nullptr);                    //and logs outlive frames
+
+            m_workers.reserve(m_thread_count);
+            for (uint32_t i = 0; i < m_thread_count; i++) {
+                m_workers.emplace_back(arena == nullptr ? mr : arena->upstream()); //queues, free list and log of thread i
+                m_workers[i].m_random = i + 1;                      //seed must not be 0
+                m_workers[i].m_next = i;                            //start stealing from different queues
+            }
+            m_instance.store(this, std::memory_order::release);     //schedule() now uses this job system, whose workers exist
+
+            for (uint32_t i = start_idx; i < m_thread_count; i++) {
+                std::cout << "Starting thread " << i << std::endl;
+                m_threads.push_back(std::thread(&JobSystem::thread_task, this, i));	//spawn the pool threads
+                m_threads.back().detach();
+            }
+        };
+
+        /**
+        * \brief Access to the current job system.
+        *
+        * Returns the job system that was constructed last and is still alive. If there is none,
+        * the singleton is created with the given parameters.
+        *
+        * \param[in] threadCount Number of threads in the system.
+        * \param[in] start_idx Number of first thread, if 1 then the main thread should enter as thread 0.
+        * \param[in] mr The memory resource to use for allocating Jobs.
+        * \returns a pointer to the JobSystem instance.
+        */
+        static JobSystem& instance(uint32_t threadCount = 0, uint32_t start_idx = 0, std::pmr::memory_resource* mr = std::pmr::new_delete_resource()) noexcept {
+            JobSystem* current = m_instance.load(std::memory_order::acquire);
+            if (current == nullptr) [[unlikely]] {
+                static JobSystem instance(threadCount, start_idx, mr); //thread safe init guaranteed - Meyer's Singleton
+                JobSystem* expected = nullptr;
+                m_instance.compare_exchange_strong(expected, &instance);    //the singleton again, after another system was destroyed
+                current = m_instance.load(std::memory_order::acquire);
+            }
+            return *current;
+        };
+
+        /**
+        * \brief Test whether the job system has been started yet.
+        * \returns true if the instance exists, else false.
+        */
+        static bool is_instance_created() noexcept {
+            return m_thread_index >= 0;
+        };
+
+        JobSystem(const JobSystem&) = delete;				// non-copyable,
+        JobSystem& operator=(const JobSystem&) = delete;
+        JobSystem(JobSystem&&) = default;					// but movable
+        JobSystem& operator=(JobSystem&&) = default;
+
+        /**
+        * \brief JobSystem class destructor.
+        *
         * By default shuts down the system and waits for the threads to terminate.
+        * Jobs that have not run yet are dropped.
         */
         ~JobSystem() noexcept {
             m_terminate = true;
             wait_for_termination();
+            JobSystem* self = this;
+            m_instance.compare_exchange_strong(self, nullptr);     //instance() falls back to the singleton
         };
 
         void on_finished(Job* job) noexcept;            //called when the job finishes, i.e. all children have finished
@@ -445,72 +1529,215 @@ namespace vgjs {
             return false;
         }
 
+        /**
+        * \brief Decide whether a coro may be resumed right away by this thread.
+        *
+        * E.g. a child whose last child just finished returns the handle of the parent from its final
+        * or yield awaiter (symmetric transfer), instead of scheduling it into a queue. Or a coro awaiting 
+        * a single child coro transfers to the child. This is not done if the coro must run on another 
+        * thread, while logging so that each run of a coro is traced on its own, and after c_max_transfers
+        * transfers during the current job, so that the stack is bounded even if the compiler does not 
+        * turn the transfer into a tail call.
+        *
+        * \param[in] job The coro.
+        * \returns true if the caller resumes the coro, which is then the current job, else false.
+        */
+        bool transfer(Job_base* job) noexcept {
+            if (m_thread_index < 0 || is_logging()) return false;
+            if (job->m_thread_index >= 0 && job->m_thread_index != m_thread_index) return false;
+            JobWorker& w = m_workers[m_thread_index];
+            if (w.m_transfers >= c_max_transfers) return false;
+            ++w.m_transfers;
+            JobCounters::add(w.m_counters.m_coros);
+            job->m_enqueued = 0;
+            job->m_suspended = false;
+            m_current_job = job;        //children scheduled by the parent must find their parent
+            return true;
+        }
+
+        /**
+        * \brief Set whether a single child awaited by a coro runs on the awaiting thread (work first).
+        *
+        * A child coro is then resumed by symmetric transfer, and a function runs right away inside
+        * co_await, instead of going through a queue, and the parent goes on right after it, if the 
+        * child did not start children of its own. Can also be chosen for each co_await with inlined().
+        *
+        * \param[in] on If true, run single awaited children inline.
+        */
+        void set_inline_awaits(bool on) noexcept {
+            m_inline_awaits.store(on, std::memory_order::relaxed);
+        }
+
+        bool inline_awaits() noexcept {
+            return m_inline_awaits.load(std::memory_order::relaxed);
+        }
+
+        /**
+        * \brief Run a function, awaited as the only child of a coro, right away on this thread.
+        *
+        * The parent counts one more child while the job runs, so that the job finishing does not schedule
+        * the parent, which is suspended in co_await on this thread. If the job must run on another thread,
+        * or while logging, it is scheduled instead.
+        *
+        * \param[in] job The job holding the function.
+        * \param[in] parent The coro awaiting the job.
+        * \returns true if the job and its children have finished, so the parent can go on right away.
+        */
+        bool run_inline(Job* job, Job_base* parent) noexcept {
+            job->m_parent = parent;
+            if (m_thread_index < 0 || is_logging() || (job->m_thread_index >= 0 && job->m_thread_index != m_thread_index)) {
+                parent->m_children.fetch_add(1);
+                schedule(job);
+                return false;
+            }
+            parent->m_children.fetch_add(2);                //the job, and this call
+            JobCounters::add(m_workers[m_thread_index].m_counters.m_jobs);
+            Job_base* current = m_current_job;
+            m_current_job = job;                            //children of the function find their parent
+            (*job)();
+            m_current_job = current;
+            child_finished(job);                            //finishes the job if it has no children
+            return parent->m_children.fetch_sub(1) == 1;    //nothing left to wait for
+        }
+
+        bool run_inline(Function&& f, Job_base* parent) noexcept {
+            return run_inline(allocate_job(std::forward<Function>(f)), parent);
+        }
+
+        bool run_inline(std::function<void(void)>&& f, Job_base* parent) noexcept {
+            return run_inline(Function{ std::forward<std::function<void(void)>>(f) }, parent);
+        }
+
+        template<typename F>
+        requires FUNCTOR<F>
+        bool run_inline(F&& f, Job_base* parent) noexcept {
+            Job* job = allocate_job();
+            job->set_function(std::forward<F>(f));
+            return run_inline(job, parent);
+        }
+
         /**
         * \brief Every thread runs in this function
         * \param[in] threadIndex Number of this thread
         */
         void thread_task(int32_t threadIndex = 0) noexcept {
-            constexpr uint32_t NOOP = 10;                                   //number of empty loops until garbage collection
+            constexpr uint32_t NOOP = 10;                                   //number of loops until logging the lock counters
             m_thread_index = threadIndex;	                                //Remember your own thread index number
-            static std::atomic<uint32_t> thread_counter = m_thread_count.load();	//Counted down when started
-
-            thread_counter--;			                                    //count down
-            while (thread_counter.load() > 0) {}	                        //Continue only if all threads are running
+            m_start_counter--;			                                    //count down
+            while (m_start_counter.load() > 0) {}	                        //Continue only if all threads are running
 
-            uint32_t next = rand() % m_thread_count;                        //initialize at random position for stealing
-            thread_local uint32_t noop = NOOP;                               //number of empty loops until threads sleeps
+            JobWorker& worker = m_workers[threadIndex];                     //all data of this thread
+            JobCounters& counters = worker.m_counters;                      //statistics of this thread
+            worker.m_noop = NOOP;                                           //number of loops until logging the lock counters
+            uint64_t t0 = TraceClock::now();                                //end of the last job
             while (!m_terminate) {			                                //Run until the job system is terminated
-                m_current_job = m_local_queues[m_thread_index].pop();       //try get a job from the local queue
-                if (m_current_job == nullptr) {
-                    m_current_job = m_global_queues[m_thread_index].pop();  //try get a job from the global queue
+                uint32_t queue = LatencyRecorder::c_local;                  //where the job came from
+                m_current_job = worker.m_local_queue.pop();                 //try get a job from the local queue
+                if (m_current_job != nullptr) {
+                    JobCounters::add(counters.m_local_pops);
+                }
+                else {
+                    queue = LatencyRecorder::c_global;
+                    m_current_job = worker.m_global_queue.pop();            //try get a job from the global queue
+                    if (m_current_job != nullptr) JobCounters::add(counters.m_global_pops);
                 }
                 if (m_current_job == nullptr) {                             //try steal job from another thread
-                    if (++next >= m_thread_count) next = 0;
-                    m_current_job = m_global_queues[next].pop();
+                    if (++worker.m_next >= m_workers.size()) worker.m_next = 0;
+                    queue = worker.m_next == (uint32_t)threadIndex ? LatencyRecorder::c_global : LatencyRecorder::c_stolen;
+                    m_current_job = m_workers[worker.m_next].m_global_queue.pop();
+                    JobCounters::add(counters.m_steal_attempts);
+                    if (m_current_job != nullptr) JobCounters::add(counters.m_steals);
                 }
 
-                if (m_current_job != nullptr) {
-                    std::chrono::high_resolution_clock::time_point t1, t2;	///< execution start and end
-
-                    if (is_logging()) {
-                        t1 = std::chrono::high_resolution_clock::now();	//time of finishing;
-                    }
+                uint64_t t1 = TraceClock::now();	                        //execution start
+                JobCounters::add(counters.m_idle_ticks, t1 - t0);
+                t0 = t1;
 
+                if (m_current_job != nullptr) {
                     auto is_function = m_current_job->is_function();      //save certain info since a coro might be destroyed
-                    auto type = m_current_job->m_type;
-                    auto id = m_current_job->m_id;
+                    JobCounters::add(is_function ? counters.m_jobs : counters.m_coros);
+
+                    bool logging = is_logging();
+                    bool traced = false;
+                    int32_t type = -1, id = -1;
+                    uint32_t enqueued = m_current_job->m_enqueued;
+                    bool suspended = m_current_job->m_suspended;
+                    Job_base* job = m_current_job;
+                    if (logging) {
+                        type = m_current_job->type();
+                        id = m_current_job->id();
+                        if (enqueued != 0) {                                //time spent in the queue
+                            worker.m_latency.record(type, queue, (uint32_t)t1 - enqueued);
+                        }
+                        traced = worker.m_sampler.select(type);
+                        if (!is_function) {                                 //parked and lifetime spans of coros
+                            if (suspended) log_coro(JobLog::c_coro_resume, m_current_job, t1);
+                            if (traced && !m_current_job->m_lifetime) {
+                                m_current_job->m_lifetime = true;
+                                log_coro(JobLog::c_coro_begin, m_current_job, t1);
+                            }
+                        }
+                    }
+                    m_current_job->m_enqueued = 0;
+                    m_current_job->m_suspended = false;
+                    worker.m_slice_start = t1;
+                    worker.m_slice_end = 0;
+                    worker.m_traced = traced;
+                    worker.m_transfers = 0;
 
                     (*m_current_job)();   //if any job found execute it - a coro might be destroyed here!
 
-                    if (is_logging()) {
-                        t2 = std::chrono::high_resolution_clock::now();	//time of finishing
-                        log_data(t1, t2, m_thread_index, false, type, id );
+                    uint64_t t2 = TraceClock::now();                        //execution end
+                    JobCounters::add(counters.m_busy_ticks, t2 - t1);
+                    t0 = t2;
+                    worker.m_slice_end = t2;
+                    worker.m_traced = traced && worker.m_sampler.keep(t2 - t1);   //continuations scheduled now point here
+                    if (worker.m_traced) {
+                        if (enqueued != 0) {                                //arrow from the scheduler
+                            log_flow(JobLog::c_flow_end, flow_id(job, enqueued), t1);
+                        }
+                        if (suspended) {                                    //arrow from the suspension of the coro
+                            log_flow(JobLog::c_flow_end, flow_id(job, 0), t1);
+                        }
+                        worker.m_log.push({ t1, t2, (uint32_t)m_thread_index, false, JobLog::c_run, type, id });
                     }
 
                     if (is_function) {
-                        child_finished((Job*)m_current_job);  //a job always finishes itself, a coro will deal with this itself
+                        child_finished(job);  //a job always finishes itself, a coro will deal with this itself
                     }
                 }
-                --noop;
-                if (noop == 0) {                //if none found too longs let thread sleep
-                    noop = NOOP;
-                    if (m_thread_index == 0) {  //thread 0 is the garbage collector
-                        m_delete.clear();       //delete jobs to reclaim memory
+                else {
+                    JobCounters::add(counters.m_idle_loops);
+                }
+                if (--worker.m_noop == 0) {
+                    worker.m_noop = NOOP;
+                    if constexpr (c_lock_stats) {
+                        if (is_logging()) log_locks(worker);
                     }
                 }
+                if (worker.m_reclaim.m_size > 0) {
+                    reclaim(worker);            //every thread frees its own retired jobs
+                }
             };
 
            //std::cout << "Thread " << m_thread_index << " left " << m_thread_count << "\n";
 
-           m_global_queues[m_thread_index].clear(); //clear your global queue
-           m_local_queues[m_thread_index].clear();  //clear your local queue
+           worker.m_global_queue.clear(); //clear your global queue
+           worker.m_local_queue.clear();  //clear your local queue
 
-           uint32_t num = m_thread_count.fetch_sub(1);  //last thread clears recycle and garbage queues
+           uint32_t num = m_thread_count.fetch_sub(1);  //last thread clears recycle and retired jobs
            if (num == 1) {
-               m_recycle.clear();
-               m_delete.clear();
+               for (auto& w : m_workers) {
+                   w.m_recycle.clear();
+                   while (Job* job = w.m_reclaim.pop()) {
+                       job_deallocator{}.deallocate(job);
+                   }
+               }
 
-               if (m_logging) {         //dump trace file
+               if (m_streaming) {       //close the binary trace file
+                   disable_streaming();
+               }
+               else if (m_logging) {    //dump trace file
                    save_log_file();
                }
                //std::cout << "Last thread " << m_thread_index << " terminated\n";
@@ -518,21 +1745,63 @@ namespace vgjs {
            }
         };
 
+        /**
+        * \brief Free retired jobs, called by each thread for its own jobs between two jobs.
+        *
+        * A retired Job was finished and recycled, so no thread holds a pointer to it anymore
+        * and it can be freed right away. At most c_reclaim_batch jobs are freed per call, so
+        * that a thread never stalls, and since every thread frees only what it retired itself,
+        * a busy thread does not hold back the others.
+        *
+        * \param[in] worker The data of the calling thread.
+        */
+        void reclaim(JobWorker& worker) noexcept {
+            for (uint32_t i = 0; i < c_reclaim_batch; ++i) {    //bounded batch, so the thread does not stall
+                Job* job = worker.m_reclaim.pop();
+                if (job == nullptr) break;
+                job_deallocator{}.deallocate(job);
+                worker.m_retired.store(worker.m_retired.load(std::memory_order::relaxed) - 1, std::memory_order::relaxed);
+            }
+        }
+
         /**
         * \brief An old Job can be recycled. 
         * 
-        * There is one recycle queue that can store old Jobs. 
-        * If it is full then put the Job to the delete queue.
+        * Each thread has a recycle queue that can store old Jobs. 
+        * If it is full then the Job is retired, and freed later by this thread.
+        * Jobs allocated from a FrameArena are deallocated right away.
+        * Only threads of the job system finish jobs, so only they call this function.
         * 
         * \param[in] job Pointer to the finished Job.
         */
         void recycle(Job* job) noexcept {
-            if (m_recycle.size() <= c_queue_capacity) {
-                m_recycle.push(job);        //save it so it can be reused later
+            if (!m_recycle_jobs) {
+                job_deallocator{}.deallocate(job);  //deallocation is only a counter, and the memory belongs to a frame
+                return;
             }
-            else {
-                m_delete.push(job);   //push to delete queue
+            auto& w = worker();
+            if (w.m_recycle.size() <= c_queue_capacity) {
+                w.m_recycle.push(job);      //save it so it can be reused later
+                return;
+            }
+            w.m_reclaim.push(job);          //retire the job, it is freed in the next loops of this thread
+            auto retired = w.m_retired.load(std::memory_order::relaxed) + 1;   //only this thread writes, other threads may read
+            w.m_retired.store(retired, std::memory_order::relaxed);
+            if (retired > w.m_retired_peak.load(std::memory_order::relaxed)) {
+                w.m_retired_peak.store(retired, std::memory_order::relaxed);
+            }
+        }
+
+        /**
+        * \brief Get the highest amount of memory held by retired jobs.
+        * \returns the sum of the per-thread peaks of retired job memory in bytes.
+        */
+        std::size_t retired_peak() noexcept {
+            std::size_t peak = 0;
+            for (auto& w : m_workers) {
+                peak += w.m_retired_peak.load(std::memory_order::relaxed);
             }
+            return peak * sizeof(Job);
         }
 
         /**
@@ -548,134 +1817,518 @@ namespace vgjs {
         * Can be called by the main thread to wait for all threads to terminate.
         * Returns as soon as all threads have exited.
         */
-        void wait_for_termination() noexcept {
-            while (m_terminated.load() == false) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            }
-        };
+        void wait_for_termination() noexcept {
+            while (m_terminated.load() == false) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        };
+
+        /**
+        * \brief Get a pointer to the current job.
+        * \returns a pointer to the current job.
+        */
+        Job_base* current_job() noexcept {
+            return m_current_job;
+        }
+
+        /**
+        * \brief Get the thread index the current job is running on.
+        * \returns the index of the thread the current job is running on, or -1.
+        */
+        static int32_t thread_index() {
+            return m_thread_index;
+        }
+
+        /**
+        * \brief Get the number of threads in the system.
+        * \returns the number of threads in the system.
+        */
+        uint32_t thread_count() {
+            return m_thread_count;
+        }
+
+        /**
+        * \brief Get the per-thread data of the calling thread.
+        * Threads that do not belong to the job system (e.g. the main thread) share the data of thread 0.
+        * \returns a reference to the per-thread data of the calling thread.
+        */
+        JobWorker& worker() noexcept {
+            return m_workers[m_thread_index < 0 ? 0 : m_thread_index];
+        }
+
+        /**
+        * \brief Get the number of per-thread data slots, i.e. the number of threads the system was started with.
+        * \returns the number of per-thread data slots.
+        */
+        uint32_t worker_count() noexcept {
+            return (uint32_t)m_workers.size();
+        }
+
+        /**
+        * \brief Schedule a job into the job system.
+        * The Job will be put into a thread's queue for consumption.
+        * 
+        * \param[in] job A pointer to the job to schedule.
+        */
+        void schedule(Job_base* job ) noexcept {
+            assert(job!=nullptr);
+
+            if (is_logging()) {         //stamp for measuring the queue wait, 0 means not stamped
+                uint64_t now = TraceClock::now();
+                job->m_enqueued = (uint32_t)now | 1;
+                JobWorker* w = m_thread_index >= 0 ? &m_workers[m_thread_index] : nullptr;
+                if (w != nullptr && w->m_traced) {  //arrow from the running job, or the one that just finished, e.g. to its continuation
+                    log_flow(JobLog::c_flow_start, flow_id(job, job->m_enqueued), w->m_slice_end == 0 ? now : w->m_slice_start);
+                }
+            }
+
+            if (job->m_thread_index < 0 || job->m_thread_index >= (int)m_workers.size() ) {
+                uint32_t idx = m_thread_index < 0 ? rand() : m_workers[m_thread_index].random();   //only worker threads own a generator
+                m_workers[idx % m_workers.size()].m_global_queue.push(job);
+                return;
+            }
+
+            m_workers[job->m_thread_index].m_local_queue.push(job);
+        };
+
+        /**
+        * \brief Schedule a Job holding a function into the job system.
+        * \param[in] source An external function that is copied into the scheduled job.
+        * \param[in] parent The parent of this Job.
+        * \param[in] children Number used to increase the number of children of the parent.
+        */
+        void schedule(Function&& source, Job_base* parent = m_current_job, int32_t children = 1) noexcept {
+            Job *job = allocate_job( std::forward<Function>(source) );
+            job->m_parent = parent;
+            if (parent != nullptr) { parent->m_children.fetch_add((int)children); }
+            schedule(job);
+        };
+
+        /**
+        * \brief Schedule a Job holding a function into the job system.
+        * \param[in] source An external function that is copied into the scheduled job.
+        * \param[in] parent The parent of this Job.
+        * \param[in] children Number used to increase the number of children of the parent.
+        */
+        void schedule(std::function<void(void)>&& f, Job_base* parent = m_current_job, int32_t children = 1) noexcept {
+            schedule(Function{ std::forward<std::function<void(void)>>(f) }, parent, children );
+        }
+
+        /**
+        * \brief Schedule a Job holding a callable, e.g. a lambda, into the job system.
+        * The callable is stored in the Job itself, without wrapping it into a std::function.
+        * \param[in] f The callable.
+        * \param[in] parent The parent of this Job.
+        * \param[in] children Number used to increase the number of children of the parent.
+        */
+        template<typename F>
+        requires FUNCTOR<F>
+        void schedule(F&& f, Job_base* parent = m_current_job, int32_t children = 1) noexcept {
+            Job* job = allocate_job();
+            job->set_function(std::forward<F>(f));
+            job->m_parent = parent;
+            if (parent != nullptr) { parent->m_children.fetch_add((int)children); }
+            schedule(job);
+        }
+
+        /**
+        * \brief Store a continuation for the current Job. Will be scheduled once the current Job finishes.
+        * \param[in] f The function to schedule as continuation.
+        */
+        void continuation( Function&& f ) noexcept {
+            Job_base* current = current_job();
+            if (current == nullptr || !current->is_function()) {
+                return;
+            }
+            ((Job*)current)->m_continuation = allocate_job(std::forward<Function>(f));
+        }
+
+        /**
+        * \brief Store a callable, e.g. a lambda, as continuation for the current Job.
+        * \param[in] f The callable to schedule as continuation.
+        */
+        template<typename F>
+        requires FUNCTOR<F>
+        void continuation(F&& f) noexcept {
+            Job_base* current = current_job();
+            if (current == nullptr || !current->is_function()) {
+                return;
+            }
+            Job* job = allocate_job();
+            job->set_function(std::forward<F>(f));
+            ((Job*)current)->m_continuation = job;
+        }
+
+        //-----------------------------------------------------------------------------------------
+
+        /**
+        * \brief Get the logging data of a thread so it can be saved to file.
+        * \param[in] thread_index The thread whose log is returned.
+        * \returns a reference to the logging data.
+        */
+        auto& get_logs(int32_t thread_index) {
+            return m_workers[thread_index].m_log;
+        }
+
+        /**
+        * \brief Clear all logs.
+        */
+        void clear_logs() {
+            if (m_streaming) {          //the trace writer is the only reader of the rings
+                return;
+            }
+            for (auto& w : m_workers) {
+                w.m_log.clear();
+            }
+        }
+
+        /**
+        * \brief Compute the critical path of the jobs logged so far.
+        * The logs are consumed, so call this instead of saving them. Does nothing while streaming,
+        * use analyze_trace() on the trace file instead.
+        * \returns the work, the span and the jobs on the critical path.
+        */
+        CriticalPath critical_path() {
+            std::vector<JobLog> events;
+            if (!m_streaming) {
+                for (auto& w : m_workers) {
+                    w.m_log.drain([&](JobLog& ev) { events.push_back(ev); });
+                }
+            }
+            return compute_critical_path(events, m_clock.ns_per_tick());
+        }
+
+        /**
+        * \brief Enable logging.
+        * If logging is enabled, start/stop times and other data of each thread is saved
+        * in a memory data structure.
+        */
+        void enable_logging() {
+            calibrate_clock();
+            m_lock_interval = (uint64_t)(1.0e6 / m_clock.ns_per_tick());    //1 ms
+            for (auto& w : m_workers) {
+                w.m_log.allocate();     //recording never allocates
+                w.m_latency.allocate();
+            }
+            m_logging = true;
+        }
+
+        /**
+        * \brief Select the jobs that are traced, by type, by thread, by sampling 1 in N jobs,
+        * and by a minimum duration. Call while logging is off.
+        * \param[in] filter The filter, the default filter traces all jobs.
+        */
+        void set_trace_filter(const TraceFilter& filter = {}) {
+            calibrate_clock();
+            for (uint32_t i = 0; i < m_workers.size(); ++i) {
+                m_workers[i].m_sampler.set(filter, i, m_clock.ns_per_tick());
+            }
+        }
+
+        /**
+        * \brief Disable logging.
+        * If logging is enabled, start/stop times and other data of each thread is saved
+        * in a memory data structure.
+        * \param[in] parallel If true and called from a job, the log file is written by children of this job.
+        */
+        void disable_logging(bool parallel = false) {
+            if (m_streaming) {
+                disable_streaming();
+            }
+            else if (m_logging && parallel && m_thread_index >= 0) {
+                m_logging = false;
+                save_log_file_parallel();   //written by children of the current job
+            }
+            else if (m_logging) {
+                save_log_file();
+            }
+            m_logging = false;
+        }
+
+        /**
+        * \brief Enable logging, and stream the trace into a binary file while the system runs.
+        *
+        * A background thread drains the trace rings of all threads every millisecond, so long
+        * sessions can be recorded with bounded memory. Call disable_logging() to stop, and 
+        * convert_trace() to turn the file into a JSON file for viewing.
+        *
+        * \param[in] filename Name of the binary trace file.
+        * \returns true if streaming is on.
+        */
+        bool enable_streaming(const std::string& filename = "log.bin") {
+            if (m_streaming) {
+                return true;
+            }
+            m_trace_file.open(filename, std::ios::binary | std::ios::trunc);
+            if (!m_trace_file) {
+                return false;
+            }
+            enable_logging();
+            TraceFileHeader header;
+            header.m_tick = TraceClock::now();
+            header.m_ns = m_clock.to_ns(header.m_tick, m_start_time);
+            header.m_ns_per_tick = m_clock.ns_per_tick();
+            m_trace_file.write((char*)&header, sizeof(header));
+            m_trace_buffer.reserve(TraceRing::c_capacity);
+
+            m_streaming = true;
+            m_trace_writer = std::thread([this]() {
+                while (m_streaming) {
+                    write_trace();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            });
+            return true;
+        }
+
+        /**
+        * \brief Stop the trace writer, write the remaining events and the type names, and close the file.
+        */
+        void disable_streaming() {
+            if (!m_streaming) {
+                return;
+            }
+            m_logging = false;
+            m_streaming = false;
+            m_trace_writer.join();
+            write_trace();
+            for (auto& [type, name] : m_types) {
+                TraceBlock block{ TraceBlock::c_type, (uint32_t)name.size() };
+                m_trace_file.write((char*)&block, sizeof(block));
+                m_trace_file.write((char*)&type, sizeof(type));
+                m_trace_file.write(name.data(), name.size());
+            }
+            m_trace_file.close();
+        }
+
+        /**
+        * \brief Drain the trace rings of all threads into the trace file, called by the trace writer.
+        */
+        void write_trace() {
+            for (auto& w : m_workers) {
+                m_trace_buffer.clear();
+                w.m_log.drain([&](JobLog& ev) { m_trace_buffer.push_back(ev); });
+                if (!m_trace_buffer.empty()) {
+                    TraceBlock block{ TraceBlock::c_events, (uint32_t)m_trace_buffer.size() };
+                    m_trace_file.write((char*)&block, sizeof(block));
+                    m_trace_file.write((char*)m_trace_buffer.data(), m_trace_buffer.size() * sizeof(JobLog));
+                }
+            }
+        }
+
+        /**
+        * \brief Ask whether logging is currently enabled or not
+        * \returns true or false
+        */
+        bool is_logging() {
+            return m_logging.load(std::memory_order::relaxed);
+        }
+
+        /**
+        * \brief Get the clock used for tracing, to convert its ticks to nanoseconds.
+        * \returns the trace clock.
+        */
+        TraceClock& trace_clock() {
+            return m_clock;
+        }
 
         /**
-        * \brief Get a pointer to the current job.
-        * \returns a pointer to the current job.
+        * \brief Compute the id of a flow arrow in the trace.
+        * \param[in] job The job the arrow points to.
+        * \param[in] stamp The enqueue stamp of the job, or 0 for the arrow from the suspension of a coro.
+        * \returns the id.
         */
-        Job_base* current_job() noexcept {
-            return m_current_job;
+        static uint64_t flow_id(Job_base* job, uint32_t stamp) noexcept {
+            return ((uint64_t)(uintptr_t)job << 16) ^ stamp;
         }
 
         /**
-        * \brief Get the thread index the current job is running on.
-        * \returns the index of the thread the current job is running on, or -1.
+        * \brief Record the start or end of a flow arrow in the trace of the calling thread.
+        * \param[in] kind JobLog::c_flow_start or JobLog::c_flow_end.
+        * \param[in] id The id of the arrow.
+        * \param[in] tick The time of the event, must lie in a job of this thread.
         */
-        int32_t thread_index() {
-            return m_thread_index;
+        void log_flow(uint8_t kind, uint64_t id, uint64_t tick) noexcept {
+            if (m_thread_index < 0) return;
+            m_workers[m_thread_index].m_log.push({ tick, id, (uint32_t)m_thread_index, false, kind });
         }
 
         /**
-        * \brief Get the number of threads in the system.
-        * \returns the number of threads in the system.
+        * \brief A coro is about to suspend, start an arrow to its resumption. Call before scheduling
+        * anything that could resume the coro.
+        * \param[in] job The promise of the coro.
         */
-        uint32_t thread_count() {
-            return m_thread_count;
+        void log_suspend(Job_base* job) noexcept {
+            if (!is_logging() || m_thread_index < 0 || !m_workers[m_thread_index].m_traced) return;
+            job->m_suspended = true;
+            uint64_t now = TraceClock::now();
+            log_flow(JobLog::c_flow_start, flow_id(job, 0), now);
+            log_coro(JobLog::c_coro_suspend, job, now);
         }
 
         /**
-        * \brief Schedule a job into the job system.
-        * The Job will be put into a thread's queue for consumption.
-        * 
-        * \param[in] job A pointer to the job to schedule.
+        * \brief Record a suspension, resumption, first run or end of a coro. The id of a coro is the
+        * address of its promise, which is stable while it lives.
+        * \param[in] kind One of the JobLog::c_coro_ kinds.
+        * \param[in] job The promise of the coro.
+        * \param[in] tick The time of the event.
         */
-        void schedule(Job_base* job ) noexcept {
-            assert(job!=nullptr);
+        void log_coro(uint8_t kind, Job_base* job, uint64_t tick) noexcept {
+            if (m_thread_index < 0) return;
+            m_workers[m_thread_index].m_log.push({ tick, (uint64_t)(uintptr_t)job, (uint32_t)m_thread_index, false, kind, job->type(), job->id() });
+        }
 
-            if (job->m_thread_index < 0 || job->m_thread_index >= (int)m_thread_count ) {
-                 m_global_queues[rand() % m_thread_count].push(job);
-                 return;
+        /**
+        * \brief Log the lock contention of the queues of a worker since the last call, at most once per millisecond.
+        * Intervals without contention are only logged once, to bring the counter in the trace back to zero.
+        * \param[in] worker The worker of the calling thread.
+        */
+        void log_locks(JobWorker& worker) noexcept {
+            uint64_t now = TraceClock::now();
+            if (now - worker.m_lock_sample < m_lock_interval) return;
+            worker.m_lock_sample = now;
+
+            LockCounters* counters[] = { &worker.m_local_queue.m_lock_counters, &worker.m_global_queue.m_lock_counters, &worker.m_recycle.m_lock_counters };
+            for (int32_t q = 0; q < 3; ++q) {
+                uint64_t ticks = counters[q]->m_spin_ticks.load(std::memory_order::relaxed);
+                uint64_t contended = counters[q]->m_contended.load(std::memory_order::relaxed);
+                auto& last = worker.m_lock_last[q];
+                bool active = contended != last.m_contended;
+                if (active || last.m_active) {
+                    worker.m_log.push({ now, ticks - last.m_spin_ticks, (uint32_t)m_thread_index, false, JobLog::c_lock, q, (int32_t)(contended - last.m_contended) });
+                }
+                last = { ticks, contended, active };
             }
-
-            m_local_queues[job->m_thread_index].push(job);
-        };
+        }
 
         /**
-        * \brief Schedule a Job holding a function into the job system.
-        * \param[in] source An external function that is copied into the scheduled job.
-        * \param[in] parent The parent of this Job.
-        * \param[in] children Number used to increase the number of children of the parent.
+        * \brief A coro has finished, end its lifetime in the trace. Call before its parent can resume.
+        * \param[in] job The promise of the coro.
         */
-        void schedule(Function&& source, Job_base* parent = m_current_job, int32_t children = 1) noexcept {
-            Job *job = allocate_job( std::forward<Function>(source) );
-            job->m_parent = parent;
-            if (parent != nullptr) { parent->m_children.fetch_add((int)children); }
-            schedule(job);
-        };
+        void log_coro_end(Job_base* job) noexcept {
+            if (!job->m_lifetime || !is_logging()) return;
+            log_coro(JobLog::c_coro_end, job, TraceClock::now());
+        }
 
         /**
-        * \brief Schedule a Job holding a function into the job system.
-        * \param[in] source An external function that is copied into the scheduled job.
-        * \param[in] parent The parent of this Job.
-        * \param[in] children Number used to increase the number of children of the parent.
+        * \brief Calibrate the trace clock, only the first call has an effect.
         */
-        void schedule(std::function<void(void)>&& f, Job_base* parent = m_current_job, int32_t children = 1) noexcept {
-            schedule(Function{ std::forward<std::function<void(void)>>(f) }, parent, children );
+        void calibrate_clock() {
+            std::call_once(m_calibrate, [this]() { m_clock.calibrate(); });
         }
 
         /**
-        * \brief Store a continuation for the current Job. Will be scheduled once the current Job finishes.
-        * \param[in] f The function to schedule as continuation.
+        * \brief Get a snapshot of the statistics of all threads.
+        *
+        * The counters are always on, and cheap since each thread writes only its own. The first 
+        * call calibrates the clock, which takes some milliseconds.
+        *
+        * \returns the statistics, one entry per thread.
         */
-        void continuation( Function&& f ) noexcept {
-            Job_base* current = current_job();
-            if (current == nullptr || !current->is_function()) {
-                return;
+        std::vector<JobStats> stats() {
+            calibrate_clock();
+            double ns_per_tick = m_clock.ns_per_tick();
+            std::vector<JobStats> result(m_workers.size());
+            for (std::size_t i = 0; i < m_workers.size(); ++i) {
+                JobCounters& c = m_workers[i].m_counters;
+                JobStats& s = result[i];
+                s.m_jobs            = c.m_jobs.load(std::memory_order::relaxed);
+                s.m_coros           = c.m_coros.load(std::memory_order::relaxed);
+                s.m_local_pops      = c.m_local_pops.load(std::memory_order::relaxed);
+                s.m_global_pops     = c.m_global_pops.load(std::memory_order::relaxed);
+                s.m_steal_attempts  = c.m_steal_attempts.load(std::memory_order::relaxed);
+                s.m_steals          = c.m_steals.load(std::memory_order::relaxed);
+                s.m_idle_loops      = c.m_idle_loops.load(std::memory_order::relaxed);
+                s.m_busy_ns         = (uint64_t)(c.m_busy_ticks.load(std::memory_order::relaxed) * ns_per_tick);
+                s.m_idle_ns         = (uint64_t)(c.m_idle_ticks.load(std::memory_order::relaxed) * ns_per_tick);
+                s.m_allocations     = c.m_allocations.load(std::memory_order::relaxed);
+                s.m_recycled        = c.m_recycled.load(std::memory_order::relaxed);
+                s.m_local_peak      = m_workers[i].m_local_queue.peak();
+                s.m_global_peak     = m_workers[i].m_global_queue.peak();
+                s.m_local_lock      = m_workers[i].m_local_queue.lock_stats(ns_per_tick);
+                s.m_global_lock     = m_workers[i].m_global_queue.lock_stats(ns_per_tick);
+                s.m_recycle_lock    = m_workers[i].m_recycle.lock_stats(ns_per_tick);
             }
-            ((Job*)current)->m_continuation = allocate_job(std::forward<Function>(f));
+            return result;
         }
 
-        //-----------------------------------------------------------------------------------------
-
         /**
-        * \brief Get the logging data so it can be saved to file.
-        * \returns a reference to the logging data.
+        * \brief Compute percentiles of the queue wait times, summed over all threads.
+        * \param[in] histogram Returns the histogram of a thread.
+        * \returns the percentiles in nanoseconds.
         */
-        auto& get_logs() {
-            return m_logs;
+        template<typename F>
+        LatencyStats latency(F&& histogram) {
+            std::vector<uint64_t> counts;
+            for (auto& w : m_workers) {
+                if (LatencyHistogram* h = histogram(w.m_latency)) h->add_to(counts);
+            }
+            LatencyStats result;
+            for (auto count : counts) result.m_count += count;
+            if (result.m_count == 0) return result;
+
+            double ns_per_tick = m_clock.ns_per_tick();
+            auto percentile = [&](double p) {
+                uint64_t target = std::max((uint64_t)std::ceil(p * result.m_count), (uint64_t)1), sum = 0;
+                for (uint32_t i = 0; i < counts.size(); ++i) {
+                    sum += counts[i];
+                    if (sum >= target) return LatencyHistogram::value(i) * ns_per_tick;
+                }
+                return 0.0;
+            };
+            result.m_p50_ns = percentile(0.5);
+            result.m_p99_ns = percentile(0.99);
+            result.m_p999_ns = percentile(0.999);
+            return result;
         }
 
         /**
-        * \brief Clear all logs.
+        * \brief Get the queue wait times per job type, recorded while logging is enabled.
+        * Types outside 0 to LatencyRecorder::c_max_types-1 are reported as type -1.
+        * \returns a map from type to percentiles, only types with jobs are in the map.
         */
-        void clear_logs() {
-            for (auto& log : m_logs) {
-                log.clear();
+        std::map<int32_t, LatencyStats> latency_by_type() {
+            std::map<int32_t, LatencyStats> result;
+            for (int32_t type = -1; type < LatencyRecorder::c_max_types; ++type) {
+                auto stats = latency([&](LatencyRecorder& r) { return r.type(type); });
+                if (stats.m_count > 0) result[type] = stats;
             }
+            return result;
         }
 
         /**
-        * \brief Enable logging.
-        * If logging is enabled, start/stop times and other data of each thread is saved
-        * in a memory data structure.
+        * \brief Get the queue wait times per queue kind, recorded while logging is enabled.
+        * \returns percentiles for jobs from the local queue, the own global queue, and stolen jobs.
         */
-        void enable_logging() {
-            m_logging = true;
+        std::array<LatencyStats, LatencyRecorder::c_queues> latency_by_queue() {
+            std::array<LatencyStats, LatencyRecorder::c_queues> result;
+            for (uint32_t queue = 0; queue < LatencyRecorder::c_queues; ++queue) {
+                result[queue] = latency([&](LatencyRecorder& r) { return r.queue(queue); });
+            }
+            return result;
         }
 
         /**
-        * \brief Disable logging.
-        * If logging is enabled, start/stop times and other data of each thread is saved
-        * in a memory data structure.
+        * \brief Reset the queue wait histograms, e.g. at the start of a frame.
+        * Jobs that are recorded at the same time may survive the reset.
         */
-        void disable_logging() {
-            if (m_logging) {
-                save_log_file();
-            }
-            m_logging = false;
+        void clear_latency() {
+            for (auto& w : m_workers) w.m_latency.clear();
         }
 
         /**
-        * \brief Ask whether logging is currently enabled or not
-        * \returns true or false
+        * \brief Get the statistics since the last call, e.g. once per frame.
+        * \param[in,out] last The snapshot of the last call, is replaced by the current snapshot.
+        * \returns the differences to the last snapshot, one entry per thread.
         */
-        bool is_logging() {
-            return m_logging;
+        std::vector<JobStats> stats_delta(std::vector<JobStats>& last) {
+            auto current = stats();
+            auto result = current;
+            for (std::size_t i = 0; i < result.size() && i < last.size(); ++i) {
+                result[i] = current[i] - last[i];
+            }
+            last = std::move(current);
+            return result;
         }
 
         /**
@@ -700,6 +2353,157 @@ namespace vgjs {
 
     };
 
+    //----------------------------------------------------------------------------------------------
+
+    /**
+    * \brief Constructor.
+    * \param[in] thread_count Number of threads of the job system, 0 means hardware concurrency.
+    * \param[in] num_buffers Number of frame buffers, between 2 and c_max_buffers, since the buffer
+    * of the current frame can only be reset once the frame is over.
+    * \param[in] upstream Memory resource that the blocks are allocated from.
+    */
+    inline FrameArena::FrameArena(uint32_t thread_count, uint32_t num_buffers, std::pmr::memory_resource* upstream) noexcept
+        : m_upstream(upstream), m_num_buffers(std::clamp(num_buffers, 2u, c_max_buffers)),
+          m_slots((thread_count == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : thread_count) + 1) {};
+
+    /**
+    * \brief Destructor, gives all blocks back to the upstream resource.
+    */
+    inline FrameArena::~FrameArena() noexcept {
+        for (auto& slot : m_slots) {
+            for (auto& buffer : slot.m_buffers) {
+                release(buffer, false);
+            }
+        }
+    }
+
+    /**
+    * \brief Get the slot of the calling thread.
+    * Threads that do not belong to the job system share slot 0.
+    * \returns the slot of the calling thread.
+    */
+    inline FrameArena::Slot& FrameArena::slot() noexcept {
+        int32_t idx = JobSystem::thread_index() + 1;
+        return m_slots[idx < (int32_t)m_slots.size() ? idx : 0];
+    }
+
+    /**
+    * \brief Give the blocks of a buffer back to the upstream resource.
+    * \param[in] buffer The buffer to release.
+    * \param[in] keep If true, keep one block of standard size for the next frame.
+    */
+    inline void FrameArena::release(Buffer& buffer, bool keep) noexcept {
+        Block* kept = nullptr;
+        Block* block = buffer.m_blocks;
+        while (block != nullptr) {
+            Block* next = block->m_next;
+            if (keep && kept == nullptr && block->m_size == c_block_size) {
+                kept = block;
+                kept->m_next = nullptr;
+            }
+            else {
+                m_upstream->deallocate(block, block->m_size, c_block_size);
+            }
+            block = next;
+        }
+        buffer.m_blocks = kept;
+        buffer.m_ptr = kept == nullptr ? nullptr : (char*)kept + c_cache_line_size;
+        buffer.m_end = kept == nullptr ? nullptr : (char*)kept + c_block_size;
+        buffer.m_live = 0;
+    }
+
+    /**
+    * \brief Bump allocate memory from the current frame buffer of this thread.
+    * \param[in] bytes Number of bytes to allocate.
+    * \param[in] alignment Alignment of the memory.
+    * \returns a pointer to the memory.
+    */
+    inline void* FrameArena::do_allocate(std::size_t bytes, std::size_t alignment) {
+        Slot& s = slot();
+        while (s.m_lock.test_and_set(std::memory_order::acquire));    //uncontended unless shared or next_frame() runs
+
+        uint32_t b = (uint32_t)(m_frame.load(std::memory_order::relaxed) % m_num_buffers);   //cannot change while the lock is held
+        Buffer& buffer = s.m_buffers[b];
+        char* ptr = (char*)(((uintptr_t)buffer.m_ptr + alignment - 1) & ~(uintptr_t)(alignment - 1));
+
+        bool large = false;
+        if (buffer.m_ptr == nullptr || ptr + bytes > buffer.m_end) {        //need a new block
+            std::size_t header = std::max(c_cache_line_size, alignment);
+            std::size_t size = std::max(c_block_size, (header + bytes + c_block_size - 1) & ~(c_block_size - 1));
+            Block* block = (Block*)m_upstream->allocate(size, c_block_size);  //aligned, so pointers find their block
+            block->m_size = size;
+            block->m_buffer = b;
+            ptr = (char*)block + header;
+            large = size > c_block_size;
+            if (large && buffer.m_blocks != nullptr) {      //large blocks hold one allocation, the current block stays in use
+                block->m_next = buffer.m_blocks->m_next;
+                buffer.m_blocks->m_next = block;
+            }
+            else {
+                block->m_next = buffer.m_blocks;
+                buffer.m_blocks = block;
+            }
+            if (!large) {
+                buffer.m_end = (char*)block + size;
+            }
+        }
+        if (!large) {
+            buffer.m_ptr = ptr + bytes;
+        }
+        buffer.m_live.fetch_add(1, std::memory_order::relaxed);    //an RMW, so it does not break the release sequence of deallocations
+
+        s.m_lock.clear(std::memory_order::release);
+        return ptr;
+    }
+
+    /**
+    * \brief Deallocation only counts down the live allocations of the buffer the memory came from.
+    * The release makes all uses of the memory visible to next_frame() before it resets the buffer.
+    * \param[in] p Pointer to the memory.
+    */
+    inline void FrameArena::do_deallocate(void* p, std::size_t, std::size_t) {
+        Block* block = (Block*)((uintptr_t)p & ~(uintptr_t)(c_block_size - 1));
+        slot().m_buffers[block->m_buffer].m_live.fetch_sub(1, std::memory_order::release);
+    }
+
+    /**
+    * \brief Test whether everything allocated from a buffer has been deallocated.
+    * \param[in] buffer The buffer to test.
+    * \returns true if there are no live allocations in the buffer.
+    */
+    inline bool FrameArena::is_drained(uint32_t buffer) noexcept {
+        int64_t live = 0;
+        for (auto& slot : m_slots) {
+            live += slot.m_buffers[buffer].m_live.load(std::memory_order::acquire);   //synchronizes with the deallocations
+        }
+        return live == 0;
+    }
+
+    /**
+    * \brief Start a new frame.
+    * The buffer of the new frame is reset if its work has drained, else it keeps growing.
+    * All slots are locked, so no thread allocates from the buffer while it is tested and reset,
+    * and threads allocating afterwards see the new frame. Concurrent deallocations only make
+    * the buffer look less drained.
+    */
+    inline void FrameArena::next_frame() noexcept {
+        for (auto& slot : m_slots) {
+            while (slot.m_lock.test_and_set(std::memory_order::acquire));
+        }
+        uint64_t frame = m_frame.load(std::memory_order::relaxed) + 1;
+        uint32_t b = (uint32_t)(frame % m_num_buffers);
+        if (is_drained(b)) {
+            for (auto& slot : m_slots) {
+                release(slot.m_buffers[b], true);
+            }
+        }
+        m_frame.store(frame, std::memory_order::relaxed);
+        for (auto& slot : m_slots) {
+            slot.m_lock.clear(std::memory_order::release);
+        }
+    }
+
+
     //----------------------------------------------------------------------------------------------
 
     /**
@@ -722,10 +2526,11 @@ namespace vgjs {
         }
 
         if (job->m_parent != nullptr) {		//if there is parent then inform it	
-            child_finished((Job*)job->m_parent);	//if this is the last child job then the parent will also finish
+            child_finished(job->m_parent);	//if this is the last child job then the parent will also finish
         }
 
-        recycle(job);       //recycle the Job
+        job->clear_function();  //release the captures now, not when the Job is reused
+        recycle(job);           //recycle the Job
     }
 
 
@@ -779,6 +2584,18 @@ namespace vgjs {
         JobSystem::instance().schedule( std::forward<std::function<void(void)>>(f), parent, children);   // forward to the job system
     };
 
+    /**
+    * \brief Schedule a callable, e.g. a lambda, into the system. It is stored in the Job without a std::function.
+    * \param[in] f A callable to schedule.
+    * \param[in] parent The parent of this Job.
+    * \param[in] children Number used to increase the number of children of the parent.
+    */
+    template<typename F>
+    requires FUNCTOR<F>
+    inline void schedule(F&& f, Job_base* parent = current_job(), int32_t children = 1) noexcept {
+        JobSystem::instance().schedule(std::forward<F>(f), parent, children);   // forward to the job system
+    };
+
     /**
     * \brief Schedule functions into the system. T can be a Function, std::function or a task<U>.
     * 
@@ -838,6 +2655,16 @@ namespace vgjs {
         JobSystem::instance().continuation(Function{ f }); // forward to the job system
     }
 
+    /**
+    * \brief Store a callable, e.g. a lambda, as continuation for the current Job.
+    * \param[in] f A callable to schedule
+    */
+    template<typename F>
+    requires FUNCTOR<F>
+    inline void continuation(F&& f) noexcept {
+        JobSystem::instance().continuation(std::forward<F>(f)); // forward to the job system
+    }
+
     //----------------------------------------------------------------------------------
 
     /**
@@ -864,12 +2691,36 @@ namespace vgjs {
     }
 
     /**
-    * \brief Enable logging.
-    * If logging is enabled, start/stop times and other data of each thread is saved
-    * in a memory data structure.
+    * \brief Disable logging and save the log file.
+    * \param[in] parallel If true and called from a job, the log file is written by children of this job.
+    */
+    inline void disable_logging(bool parallel = false) {
+        JobSystem::instance().disable_logging(parallel);
+    }
+
+    /**
+    * \brief Enable logging, and stream the trace into a binary file while the system runs.
+    * \param[in] filename Name of the binary trace file, convert it with convert_trace().
+    * \returns true if streaming is on.
+    */
+    inline bool enable_streaming(const std::string& filename = "log.bin") {
+        return JobSystem::instance().enable_streaming(filename);
+    }
+
+    /**
+    * \brief Set whether a single child awaited by a coro runs on the awaiting thread.
+    * \param[in] on If true, run single awaited children inline.
+    */
+    inline void set_inline_awaits(bool on) {
+        JobSystem::instance().set_inline_awaits(on);
+    }
+
+    /**
+    * \brief Select the jobs that are traced. Call while logging is off.
+    * \param[in] filter The filter, the default filter traces all jobs.
     */
-    inline void disable_logging() {
-        JobSystem::instance().disable_logging();
+    inline void set_trace_filter(const TraceFilter& filter = {}) {
+        JobSystem::instance().set_trace_filter(filter);
     }
 
     /**
@@ -880,11 +2731,12 @@ namespace vgjs {
     }
 
     /**
-    * \brief Get the logging data so it can be saved to file.
+    * \brief Get the logging data of a thread so it can be saved to file.
+    * \param[in] thread_index The thread whose log is returned.
     * \returns a reference to the logging data.
     */
-    inline auto& get_logs() {
-        return JobSystem::instance().get_logs();
+    inline auto& get_logs(int32_t thread_index) {
+        return JobSystem::instance().get_logs(thread_index);
     }
 
     /**
@@ -898,95 +2750,405 @@ namespace vgjs {
     /**
     * \brief Store a job run in the log data
     * 
-    * \param[in] t1 Start time of the job.
-    * \param[in] t2 End time of the job.
-    * \param[in] exec_thread Index of the thread that ran the job.
+    * \param[in] t1 Start time of the job in TraceClock ticks.
+    * \param[in] t2 End time of the job in TraceClock ticks.
+    * \param[in] exec_thread Index of the thread that ran the job, must be the calling thread.
     * \param[in] finished If true, then the job finished. 
     * \param[in] type The job type.
     * \param[in] id A unique ID.
     */
-    inline void log_data(
-        std::chrono::high_resolution_clock::time_point& t1, std::chrono::high_resolution_clock::time_point& t2,
-        int32_t exec_thread, bool finished, int32_t type, int32_t id) {
-
-        auto& logs = JobSystem::instance().get_logs();
-        logs[JobSystem::instance().thread_index()].emplace_back( t1, t2, JobSystem::instance().thread_index(), finished, type, id);
+    inline void log_data(uint64_t t1, uint64_t t2, int32_t exec_thread, bool finished, int32_t type, int32_t id) {
+        JobSystem::instance().get_logs(exec_thread).push({ t1, t2, (uint32_t)exec_thread, finished, JobLog::c_run, type, id });
     }
 
     /**
-    * \brief Store a job run in the log data
+    * \brief Names of the job types as quoted and escaped JSON strings, resolved once before writing a trace.
     *
-    * \param[in] out The output stream for the log file.
-    * \param[in] cat Undefined.
-    * \param[in] pid Always 0.
-    * \param[in] tid The thread index that ran the job.
-    * \param[in] ts Start time.
-    * \param[in] dur Duration of the job.
-    * \param[in] ph Always X
-    * \param[in] name Type name of the job.
-    * \param[in] args Indicates wehther the job has finshed.
-    */
-    inline void save_job(  std::ofstream& out, std::string cat, uint64_t pid, uint64_t tid,
-                           uint64_t ts, int64_t dur, std::string ph, std::string name, std::string args) {
-
-        std::stringstream time;
-        time.precision(15);
-        time << ts / 1.0e3;
-
-        std::stringstream duration;
-        duration.precision(15);
-        duration << dur / 1.0e3;
-
-        out << "{";
-        out << "\"cat\": " << cat << ", ";
-        out << "\"pid\": " << pid << ", ";
-        out << "\"tid\": " << tid << ", ";
-        out << "\"ts\": " << time.str() << ", ";
-        out << "\"dur\": " << duration.str() << ", ";
-        out << "\"ph\": " << ph << ", ";
-        out << "\"name\": " << name << ", ";
-        out << "\"args\": {" << args << "}";
-        out << "}";
-    }
+    * Types 0 to c_dense-1 are looked up by index, all other types in a map.
+    */
+    class TraceTypeNames {
+        static const int32_t            c_dense = 1024;
+        std::vector<std::string>        m_dense;
+        std::map<int32_t, std::string>  m_sparse;
+        std::string                     m_unnamed = "\"-\"";
+
+        static std::string quote(const std::string& name) {
+            std::string result = "\"";
+            for (char c : name) {
+                if (c == '"' || c == '\\') result += '\\';
+                if ((unsigned char)c >= 0x20) result += c;      //drop control characters
+            }
+            return result + "\"";
+        }
+
+    public:
+        TraceTypeNames(const std::map<int32_t, std::string>& types) {
+            for (auto& [type, name] : types) {
+                if (type >= 0 && type < c_dense) {
+                    if (m_dense.size() <= (std::size_t)type) m_dense.resize(type + 1);
+                    m_dense[type] = quote(name);
+                }
+                else m_sparse[type] = quote(name);
+            }
+        }
+
+        const std::string& operator[](int32_t type) const noexcept {
+            if (type >= 0 && type < (int32_t)m_dense.size()) return m_dense[type].empty() ? m_unnamed : m_dense[type];
+            if (m_sparse.empty()) return m_unnamed;
+            auto it = m_sparse.find(type);
+            return it != m_sparse.end() ? it->second : m_unnamed;
+        }
+    };
+
+    /**
+    * \brief Writes trace events in the Chrome traceEvents JSON format.
+    *
+    * Numbers are formatted with std::to_chars into a large buffer, which is written to the output
+    * stream only when it is full, so a trace is written with a few large writes. Without an output
+    * stream all text stays in the buffer, e.g. to write the events of several threads in parallel.
+    */
+    class TraceJsonWriter {
+        std::ostream*   m_out;
+        std::string     m_buffer;
+        std::size_t     m_size = 0;         //used part of the buffer
+        bool            m_comma = false;    //an event was written
+
+        char* reserve(std::size_t n) {
+            if (m_size + n > m_buffer.size()) {
+                flush();
+                if (m_size + n > m_buffer.size()) m_buffer.resize(std::max(2 * m_buffer.size(), m_size + n));
+            }
+            return m_buffer.data() + m_size;
+        }
+
+        static char* text(char* p, std::string_view s) noexcept {
+            std::memcpy(p, s.data(), s.size());
+            return p + s.size();
+        }
+
+        static char* number(char* p, uint64_t v, int base = 10) noexcept {
+            return std::to_chars(p, p + 20, v, base).ptr;
+        }
+
+        static char* us(char* p, uint64_t ns) noexcept {    //microseconds with three decimals
+            p = number(p, ns / 1000);
+            uint32_t f = ns % 1000;
+            p[0] = '.';
+            p[1] = (char)('0' + f / 100);
+            p[2] = (char)('0' + f / 10 % 10);
+            p[3] = (char)('0' + f % 10);
+            return p + 4;
+        }
+
+    public:
+        static const std::size_t c_buffer_size = 1 << 22;
+
+        TraceJsonWriter(std::ostream* out = nullptr, std::size_t size = c_buffer_size) : m_out{ out }, m_buffer(std::max(size, (std::size_t)1024), '\0') {};
+        ~TraceJsonWriter() { flush(); }
+
+        void append(std::string_view s) {       ///<append text as it is
+            text(reserve(s.size()), s);
+            m_size += s.size();
+        }
+
+        void begin() { append("{\n\"traceEvents\": [\n"); }
+        void end() { append("],\n\"displayTimeUnit\": \"ms\"\n}\n"); }
+
+        void fragment(std::string_view events) {    ///<append the text of another writer without output stream
+            if (events.empty()) return;
+            if (m_comma) append(",\n");
+            append(events);
+            m_comma = true;
+        }
+
+        /**
+        * \brief Append a job run or one end of a flow arrow.
+        * \param[in] ev The event.
+        * \param[in] ns Time of ev.m_t1 in nanoseconds since the start of the job system.
+        * \param[in] ns_per_tick Length of a tick.
+        * \param[in] types Names of the job types.
+        */
+        void event(const JobLog& ev, uint64_t ns, double ns_per_tick, const TraceTypeNames& types) {
+            if (ev.m_kind == JobLog::c_run && ev.m_t2 < ev.m_t1) return;
+            const std::string& name = types[ev.m_type];
+            char* p = reserve(256 + name.size());
+            char* start = p;
+            if (m_comma) p = text(p, ",\n");
+            if (ev.m_kind == JobLog::c_run) {
+                p = text(p, "{\"cat\": \"cat\", \"pid\": 0, \"tid\": ");
+                p = number(p, ev.m_exec_thread);
+                p = text(p, ", \"ts\": ");
+                p = us(p, ns);
+                p = text(p, ", \"dur\": ");
+                p = us(p, (uint64_t)((ev.m_t2 - ev.m_t1) * ns_per_tick));
+                p = text(p, ", \"ph\": \"X\", \"name\": ");
+                p = text(p, name);
+                p = text(p, ", \"args\": {\"id\": ");
+                p = ev.m_id < 0 ? text(p, "-") : p;
+                p = number(p, (uint64_t)std::abs((int64_t)ev.m_id));
+                p = text(p, "}}");
+            }
+            else if (ev.m_kind == JobLog::c_lock) {        //counter track per queue and thread
+                static const std::string_view queues[] = { "\"local", "\"global", "\"recycle" };
+                p = text(p, "{\"cat\": \"lock\", \"pid\": 0, \"tid\": ");
+                p = number(p, ev.m_exec_thread);
+                p = text(p, ", \"ts\": ");
+                p = us(p, ns);
+                p = text(p, ", \"ph\": \"C\", \"name\": ");
+                p = text(p, queues[std::min(std::max(ev.m_type, 0), 2)]);
+                p = text(p, " queue lock thread ");
+                p = number(p, ev.m_exec_thread);
+                p = text(p, "\", \"args\": {\"spin us\": ");
+                p = us(p, (uint64_t)(ev.m_t2 * ns_per_tick));
+                p = text(p, ", \"contended\": ");
+                p = number(p, (uint32_t)ev.m_id);
+                p = text(p, "}}");
+            }
+            else if (ev.m_kind >= JobLog::c_coro_begin && ev.m_kind <= JobLog::c_coro_end) {   //nested async spans: the lifetime of a coro, and the times it is parked
+                p = text(p, "{\"cat\": \"coro\", \"pid\": 0, \"tid\": ");
+                p = number(p, ev.m_exec_thread);
+                p = text(p, ", \"ts\": ");
+                p = us(p, ns);
+                p = text(p, ev.m_kind == JobLog::c_coro_begin || ev.m_kind == JobLog::c_coro_suspend ? ", \"ph\": \"b\", \"name\": " : ", \"ph\": \"e\", \"name\": ");
+                p = text(p, ev.m_kind == JobLog::c_coro_begin || ev.m_kind == JobLog::c_coro_end ? std::string_view{ name } : std::string_view{ "\"parked\"" });
+                p = text(p, ", \"id\": \"0x");
+                p = number(p, ev.m_t2, 16);
+                p = text(p, "\"}");
+            }
+            else {
+                p = text(p, "{\"cat\": \"flow\", \"pid\": 0, \"tid\": ");
+                p = number(p, ev.m_exec_thread);
+                p = text(p, ", \"ts\": ");
+                p = us(p, ns);
+                p = text(p, ev.m_kind == JobLog::c_flow_start ? ", \"ph\": \"s\"" : ", \"ph\": \"f\", \"bp\": \"e\"");
+                p = text(p, ", \"name\": \"flow\", \"id\": \"0x");
+                p = number(p, ev.m_t2, 16);
+                p = text(p, "\"}");
+            }
+            m_size += p - start;
+            m_comma = true;
+        }
+
+        void thread_name(uint32_t tid) {    ///<name a thread in the viewer
+            char* p = reserve(128);
+            char* start = p;
+            if (m_comma) p = text(p, ",\n");
+            p = text(p, "{\"ph\": \"M\", \"pid\": 0, \"tid\": ");
+            p = number(p, tid);
+            p = text(p, ", \"name\": \"thread_name\", \"args\": {\"name\": \"thread ");
+            p = number(p, tid);
+            p = text(p, "\"}}");
+            m_size += p - start;
+            m_comma = true;
+        }
+
+        void flush() {      ///<write the buffer to the output stream, if any
+            if (m_out == nullptr) return;
+            m_out->write(m_buffer.data(), m_size);
+            m_size = 0;
+        }
+
+        std::string take() {    ///<move the text out of a writer without output stream
+            m_buffer.resize(m_size);
+            m_size = 0;
+            return std::move(m_buffer);
+        }
+    };
 
     /**
     * \brief Dump all job data into a json log file.
     */
     inline void save_log_file() {
-        auto& logs = JobSystem::instance().get_logs();
-        std::ofstream outdata;
-        outdata.open("log.json");
-        auto& types = JobSystem::instance().types();
+        std::ofstream outdata("log.json", std::ios::binary);
+        auto& clock = JobSystem::instance().trace_clock();
+        auto start = JobSystem::instance().start_time();
 
         if (outdata) {
-            outdata << "{" << std::endl;
-            outdata << "\"traceEvents\": [" << std::endl;
-            bool comma = false;
-            for (uint32_t i = 0; i < logs.size(); ++i) {
-                for (auto& ev : logs[i]) {
-                    if (ev.m_t1 >= JobSystem::instance().start_time() && ev.m_t2 >= ev.m_t1) {
+            TraceTypeNames types(JobSystem::instance().types());
+            TraceJsonWriter writer(&outdata);
+            writer.begin();
+            for (uint32_t i = 0; i < JobSystem::instance().worker_count(); ++i) {
+                JobSystem::instance().get_logs(i).drain([&](JobLog& ev) {
+                    writer.event(ev, (uint64_t)std::max(clock.to_ns(ev.m_t1, start), 0.0), clock.ns_per_tick(), types);
+                });
+            }
+            writer.end();
+        }
+        JobSystem::instance().clear_logs();
+    }
 
-                        if (comma) outdata << "," << std::endl;
+    /**
+    * \brief Dump all job data into a json log file, using the job system.
+    *
+    * Each thread log is turned into text by its own job, then a continuation writes the file.
+    * These jobs are children of the calling job, so they finish before it does. Logging must
+    * be off, since the logs are read by other threads.
+    */
+    inline void save_log_file_parallel() {
+        schedule([]() {
+            uint32_t n = JobSystem::instance().worker_count();
+            auto parts = std::make_shared<std::vector<std::string>>(n);
+            auto types = std::make_shared<TraceTypeNames>(JobSystem::instance().types());
+
+            for (uint32_t i = 0; i < n; ++i) {
+                schedule([=]() {
+                    auto& clock = JobSystem::instance().trace_clock();
+                    auto start = JobSystem::instance().start_time();
+                    auto& log = JobSystem::instance().get_logs(i);
+                    TraceJsonWriter writer(nullptr, log.size() * 160);
+                    log.drain([&](JobLog& ev) {
+                        writer.event(ev, (uint64_t)std::max(clock.to_ns(ev.m_t1, start), 0.0), clock.ns_per_tick(), *types);
+                    });
+                    (*parts)[i] = writer.take();
+                });
+            }
 
-                        auto it = types.find(ev.m_type);
-                        std::string name = "-";
-                        if (it != types.end()) name = it->second;
+            continuation([=]() {
+                std::ofstream outdata("log.json", std::ios::binary);
+                if (outdata) {
+                    TraceJsonWriter writer(&outdata);
+                    writer.begin();
+                    for (auto& part : *parts) writer.fragment(part);
+                    writer.end();
+                }
+                JobSystem::instance().clear_logs();
+            });
+        });
+    }
 
-                        save_job(outdata, "\"cat\"", 0, (uint32_t)ev.m_exec_thread,
-                            std::chrono::duration_cast<std::chrono::nanoseconds>(ev.m_t1 - JobSystem::instance().start_time()).count(),
-                            std::chrono::duration_cast<std::chrono::nanoseconds>(ev.m_t2 - ev.m_t1).count(),
-                            "\"X\"", "\"" + name + "\"", "\"id\": " + std::to_string(ev.m_id));
+    /**
+    * \brief Read a binary trace file written by enable_streaming().
+    *
+    * \param[in] in Stream of the file, read from its start.
+    * \param[out] header The file header.
+    * \param[in] on_events Called with a vector of JobLogs for each block of events.
+    * \param[in] on_type Called with the number and the name of each type.
+    * \returns true if the file has a valid header.
+    */
+    template<typename E, typename T>
+    inline bool read_trace(std::ifstream& in, TraceFileHeader& header, E&& on_events, T&& on_type) {
+        TraceFileHeader expected;
+        in.clear();
+        in.seekg(0);
+        if (!in.read((char*)&header, sizeof(header)) || std::memcmp(header.m_magic, expected.m_magic, sizeof(header.m_magic)) != 0
+            || header.m_event_size != sizeof(JobLog)) {
+            return false;
+        }
 
-                        comma = true;
-                    }
-                }
+        std::vector<JobLog> events;
+        TraceBlock block;
+        while (in.read((char*)&block, sizeof(block))) {
+            if (block.m_tag == TraceBlock::c_events) {
+                events.resize(block.m_count);
+                if (!in.read((char*)events.data(), block.m_count * sizeof(JobLog))) break;
+                on_events(events);
             }
-            outdata << "]," << std::endl;
-            outdata << "\"displayTimeUnit\": \"ms\"" << std::endl;
-            outdata << "}" << std::endl;
+            else if (block.m_tag == TraceBlock::c_type) {
+                int32_t type;
+                std::string name(block.m_count, ' ');
+                if (!in.read((char*)&type, sizeof(type)) || !in.read(name.data(), block.m_count)) break;
+                on_type(type, name);
+            }
+            else break;
+        }
+        return true;
+    }
+
+    /**
+    * \brief Convert a binary trace file written by enable_streaming() into a JSON trace file.
+    *
+    * The output uses the Chrome traceEvents format, which is loaded by chrome://tracing/ and by
+    * the Perfetto UI at ui.perfetto.dev. Threads are named by metadata events. The file is 
+    * read twice, first for the type names stored at its end, so memory stays bounded.
+    *
+    * \param[in] in_name Name of the binary trace file.
+    * \param[in] out_name Name of the JSON file.
+    * \returns true if the trace was converted.
+    */
+    inline bool convert_trace(const std::string& in_name, const std::string& out_name) {
+        std::ifstream in(in_name, std::ios::binary);
+        TraceFileHeader header;
+        std::map<int32_t, std::string> types;
+        std::set<uint32_t> threads;
+        if (!read_trace(in, header, [&](std::vector<JobLog>& events) { for (auto& ev : events) threads.insert(ev.m_exec_thread); },
+                                    [&](int32_t type, std::string& name) { types[type] = name; })) {
+            return false;
+        }
+
+        std::ofstream out(out_name, std::ios::binary);
+        if (!out) {
+            return false;
+        }
+        TraceTypeNames names(types);
+        TraceJsonWriter writer(&out);
+        writer.begin();
+        for (auto tid : threads) {
+            writer.thread_name(tid);
+        }
+        read_trace(in, header, [&](std::vector<JobLog>& events) {
+            for (auto& ev : events) {
+                double ts = header.m_ns + (double)(int64_t)(ev.m_t1 - header.m_tick) * header.m_ns_per_tick;
+                writer.event(ev, (uint64_t)std::max(ts, 0.0), header.m_ns_per_tick, names);
+            }
+        }, [](int32_t, std::string&) {});
+        writer.end();
+        return true;
+    }
+
+    /**
+    * \brief Compute the critical path of the jobs in a binary trace file written by enable_streaming().
+    *
+    * The events are loaded into memory. To look at a single frame, pass the time window of the frame,
+    * only jobs starting inside the window are analyzed.
+    *
+    * \param[in] in_name Name of the binary trace file.
+    * \param[out] result The critical path.
+    * \param[out] types Names of the types in the trace.
+    * \param[in] from_ns Start of the time window, in ns since the start of the job system.
+    * \param[in] to_ns End of the time window.
+    * \returns true if the file could be read.
+    */
+    inline bool analyze_trace(const std::string& in_name, CriticalPath& result, std::map<int32_t, std::string>& types
+        , double from_ns = 0.0, double to_ns = std::numeric_limits<double>::max()) {
+
+        std::ifstream in(in_name, std::ios::binary);
+        TraceFileHeader header;
+        std::vector<JobLog> all;
+        if (!read_trace(in, header, [&](std::vector<JobLog>& events) {
+                for (auto& ev : events) {
+                    double ts = header.m_ns + (double)(int64_t)(ev.m_t1 - header.m_tick) * header.m_ns_per_tick;
+                    if (ts >= from_ns && ts <= to_ns) all.push_back(ev);
+                }
+            }, [&](int32_t type, std::string& name) { types[type] = name; })) {
+            return false;
+        }
+        result = compute_critical_path(all, header.m_ns_per_tick);
+        return true;
+    }
+
+    /**
+    * \brief Print a critical path.
+    * \param[in] out The output stream.
+    * \param[in] path The critical path.
+    * \param[in] types Names of the types.
+    * \param[in] top Number of jobs and types to print.
+    */
+    inline void print_critical_path(std::ostream& out, const CriticalPath& path, std::map<int32_t, std::string>& types, std::size_t top = 10) {
+        auto name = [&](int32_t type) { return types.contains(type) ? types[type] : std::to_string(type); };
+
+        out << "jobs " << path.m_num_jobs << " work " << path.m_work_ns / 1000.0 << " us span " << path.m_span_ns / 1000.0
+            << " us parallelism " << path.parallelism() << "\n";
+        out << "critical path " << path.m_path.size() << " jobs\n";
+
+        std::vector<CriticalPathJob> jobs = path.m_path;
+        std::sort(jobs.begin(), jobs.end(), [](auto& a, auto& b) { return a.m_ns > b.m_ns; });
+        for (std::size_t i = 0; i < std::min(top, jobs.size()); ++i) {
+            out << "  job " << name(jobs[i].m_type) << " id " << jobs[i].m_id << " thread " << jobs[i].m_thread << " " << jobs[i].m_ns / 1000.0 << " us\n";
+        }
+        for (std::size_t i = 0; i < std::min(top, path.m_types.size()); ++i) {
+            out << "  type " << name(path.m_types[i].first) << " " << path.m_types[i].second / 1000.0 << " us ("
+                << (path.m_span_ns > 0.0 ? 100.0 * path.m_types[i].second / path.m_span_ns : 0.0) << "%)\n";
         }
-        outdata.close();
-        JobSystem::instance().clear_logs();
     }
 
 
@@ -0,0 +1,259 @@
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <functional>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+
+#include "VEGameJobSystem.h"
+#include "VECoro.h"
+
+
+using namespace std::chrono;
+
+
+namespace bench {
+
+    using namespace vgjs;
+
+    /**
+    * \brief Let each of n threads push and pop jobs to and from its own queue, and measure the time.
+    *
+    * The threads do not share any queue, so any slowdown with more threads comes from
+    * false sharing between neighboring queues.
+    *
+    * \param[in] queue Function returning the queue of a thread.
+    * \param[in] n Number of threads.
+    * \param[in] ops Number of push/pop pairs per thread.
+    * \returns the time in ns per push/pop pair.
+    */
+    double queue_ops(std::function<JobQueue<Job_base>&(uint32_t)> queue, uint32_t n, uint32_t ops) {
+        std::vector<std::thread> threads;
+        std::atomic<uint32_t> ready = 0;
+
+        auto t1 = high_resolution_clock::now();
+        for (uint32_t i = 0; i < n; ++i) {
+            threads.push_back(std::thread([&, i]() {
+                JobQueue<Job_base>& q = queue(i);
+                Job job;
+                ready++;
+                while (ready.load() < n) {}     //start all threads at the same time
+                for (uint32_t j = 0; j < ops; ++j) {
+                    q.push(&job);
+                    q.pop();
+                }
+            }));
+        }
+        for (auto& t : threads) t.join();
+        auto t2 = high_resolution_clock::now();
+
+        return (double)duration_cast<nanoseconds>(t2 - t1).count() / ops;
+    }
+
+    /**
+    * \brief Compare queues packed into a vector against queues in cache line aligned JobWorkers.
+    */
+    void false_sharing(uint32_t ops) {
+        uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        std::vector<JobQueue<Job_base>> packed(max_threads);
+        std::vector<JobWorker> workers;
+        workers.reserve(max_threads);
+        for (uint32_t i = 0; i < max_threads; ++i) workers.emplace_back(std::pmr::new_delete_resource());
+
+        std::cout << "threads   packed ns/op   JobWorker ns/op\n";
+        for (uint32_t n = 1; n <= max_threads; n *= 2) {
+            double p = queue_ops([&](uint32_t i) -> JobQueue<Job_base>& { return packed[i]; }, n, ops);
+            double w = queue_ops([&](uint32_t i) -> JobQueue<Job_base>& { return workers[i].m_global_queue; }, n, ops);
+            std::cout << std::setw(7) << n << std::setw(15) << std::setprecision(4) << p << std::setw(18) << w << "\n";
+        }
+    }
+
+    using Mesh = std::vector<float>;
+
+    Coro<Mesh> make_mesh(std::size_t n) {
+        Mesh mesh(n, 1.0f);
+        co_return std::move(mesh);      //moved into the promise
+    }
+
+    Coro<std::unique_ptr<Mesh>> make_mesh_ptr(std::size_t n) {
+        co_return std::make_unique<Mesh>(n, 1.0f);  //move-only result
+    }
+
+    /**
+    * \brief Await coros with large results, and read them by reference or move them out.
+    * \param[in] num Number of coros.
+    * \param[in] n Number of floats in each result.
+    */
+    Coro<> large_results(uint32_t num, std::size_t n) {
+        std::size_t sum = 0;
+
+        auto t1 = high_resolution_clock::now();
+        std::pmr::vector<Coro<Mesh>> meshes;
+        for (uint32_t i = 0; i < num; ++i) meshes.emplace_back(make_mesh(n));
+        co_await meshes;
+        for (auto& mesh : meshes) sum += mesh.get().second.size();         //no copy
+        auto t2 = high_resolution_clock::now();
+
+        std::pmr::vector<Coro<Mesh>> taken;
+        for (uint32_t i = 0; i < num; ++i) taken.emplace_back(make_mesh(n));
+        co_await taken;
+        for (auto& mesh : taken) sum += mesh.take().second.size();          //moved out once
+        auto t3 = high_resolution_clock::now();
+
+        std::pmr::vector<Coro<std::unique_ptr<Mesh>>> ptrs;
+        for (uint32_t i = 0; i < num; ++i) ptrs.emplace_back(make_mesh_ptr(n));
+        co_await ptrs;
+        for (auto& ptr : ptrs) sum += ptr.take().second->size();
+        auto t4 = high_resolution_clock::now();
+
+        std::cout << "large results " << n * sizeof(float) << " bytes, " << sum << " floats\n";
+        std::cout << "  get()  ns/coro " << duration_cast<nanoseconds>(t2 - t1).count() / num << "\n";
+        std::cout << "  take() ns/coro " << duration_cast<nanoseconds>(t3 - t2).count() / num << "\n";
+        std::cout << "  unique_ptr ns/coro " << duration_cast<nanoseconds>(t4 - t3).count() / num << "\n";
+        co_return;
+    }
+
+    /**
+    * \brief Schedule n empty jobs with small captures and measure the throughput.
+    * \param[in] n Number of jobs.
+    */
+    Coro<> empty_jobs(uint32_t n) {
+        std::atomic<uint32_t> counter = 0;
+        auto f = [&counter]() { counter++; };
+        int64_t ns_lambdas = 1, ns_functions = 1;
+
+        for (uint32_t round = 0; round < 2; ++round) {      //the first round warms up the allocator
+            std::pmr::vector<decltype(f)> lambdas(n, f);
+            std::pmr::vector<std::function<void(void)>> funcs(n, f);
+
+            auto t1 = high_resolution_clock::now();
+            co_await lambdas;       //stored in the Jobs
+            auto t2 = high_resolution_clock::now();
+            co_await funcs;         //wrapped in std::function
+            auto t3 = high_resolution_clock::now();
+
+            ns_lambdas = std::max((int64_t)duration_cast<nanoseconds>(t2 - t1).count(), (int64_t)1);
+            ns_functions = std::max((int64_t)duration_cast<nanoseconds>(t3 - t2).count(), (int64_t)1);
+        }
+
+        std::cout << "empty jobs " << counter << ", sizeof(Job) " << sizeof(Job) << "\n";
+        std::cout << "  lambda jobs/s " << (uint64_t)(1.0e9 * n / ns_lambdas) << "\n";
+        std::cout << "  std::function jobs/s " << (uint64_t)(1.0e9 * n / ns_functions) << "\n";
+        co_return;
+    }
+
+    /**
+    * \brief Run n empty jobs without logging, with logging and with sampled logging, and print the tracing overhead per job.
+    * \param[in] n Number of jobs, should fit into the trace rings.
+    */
+    Coro<> trace_overhead(uint32_t n) {
+        std::atomic<uint32_t> counter = 0;
+        auto f = [&counter]() { counter++; };
+        int64_t ns[3] = { 1, 1, 1 };
+        std::array<LatencyStats, LatencyRecorder::c_queues> latency;
+
+        for (uint32_t round = 0; round < 4; ++round) {      //the first round warms up the allocator
+            if (round == 2) enable_logging();
+            if (round == 3) {
+                TraceFilter filter;
+                filter.m_sample = 16;
+                set_trace_filter(filter);
+                enable_logging();
+            }
+            std::pmr::vector<decltype(f)> lambdas(n, f);
+            auto t1 = high_resolution_clock::now();
+            co_await lambdas;
+            auto t2 = high_resolution_clock::now();
+            if (round > 0) ns[round - 1] = std::max((int64_t)duration_cast<nanoseconds>(t2 - t1).count(), (int64_t)1);
+            if (round == 2) latency = JobSystem::instance().latency_by_queue();
+            if (round >= 2) {
+                clear_logs();
+                disable_logging();
+            }
+        }
+        set_trace_filter();
+
+        std::cout << "trace overhead, " << n << " jobs\n";
+        std::cout << "  ns/job without logging " << (double)ns[0] / n << "\n";
+        std::cout << "  ns/job with logging " << (double)ns[1] / n << "\n";
+        std::cout << "  ns/job with 1 in 16 sampled " << (double)ns[2] / n << "\n";
+        std::cout << "  overhead ns/job " << (double)(ns[1] - ns[0]) / n << ", sampled " << (double)(ns[2] - ns[0]) / n << "\n";
+        const char* queues[] = { "local", "global", "stolen" };
+        for (uint32_t i = 0; i < latency.size(); ++i) {
+            std::cout << "  queue wait " << queues[i] << " jobs " << latency[i].m_count << " p50 " << latency[i].m_p50_ns 
+                << " ns p99 " << latency[i].m_p99_ns << " ns p999 " << latency[i].m_p999_ns << " ns\n";
+        }
+        co_return;
+    }
+
+    /**
+    * \brief Log n empty jobs, then write the log file sequentially and in parallel, and print events/s.
+    * \param[in] n Number of jobs, should fit into the trace rings.
+    */
+    Coro<> json_export(uint32_t n) {
+        std::atomic<uint32_t> counter = 0;
+        auto f = [&counter]() { counter++; };
+        int64_t ns[2] = { 1, 1 };
+        std::size_t events[2] = { 0, 0 };
+
+        for (uint32_t round = 0; round < 2; ++round) {      //first sequential, then parallel
+            enable_logging();
+            std::pmr::vector<decltype(f)> lambdas(n, f);
+            co_await lambdas;
+            for (uint32_t i = 0; i < JobSystem::instance().worker_count(); ++i) events[round] += get_logs(i).size();
+
+            auto t1 = high_resolution_clock::now();
+            if (round == 0) {
+                disable_logging();
+            }
+            else {
+                std::pmr::vector<std::function<void(void)>> save{ []() { disable_logging(true); } };
+                co_await save;      //the file is written by children of this job
+            }
+            auto t2 = high_resolution_clock::now();
+            ns[round] = std::max((int64_t)duration_cast<nanoseconds>(t2 - t1).count(), (int64_t)1);
+        }
+
+        std::cout << "json export\n";
+        std::cout << "  sequential events " << events[0] << " events/s " << (uint64_t)(1.0e9 * events[0] / ns[0]) << "\n";
+        std::cout << "  parallel events " << events[1] << " events/s " << (uint64_t)(1.0e9 * events[1] / ns[1]) << "\n";
+        co_return;
+    }
+
+    /**
+    * \brief Run the benchmarks one after the other, so they do not disturb each other.
+    */
+    Coro<> run_all() {
+        auto results = large_results(256, 1 << 16);
+        co_await results;
+        auto jobs = empty_jobs(1 << 18);
+        co_await jobs;
+        auto trace = trace_overhead(1 << 14);
+        co_await trace;
+        auto json = json_export(1 << 14);
+        co_await json;
+        co_return;
+    }
+
+    /**
+    * \brief Benchmarks that do not need the job system, call before JobSystem::instance().
+    */
+    void queues() {
+        false_sharing(1 << 20);
+    }
+
+    /**
+    * \brief Benchmarks running on the job system, schedule this as a job.
+    */
+    void test() {
+        std::cout << "Starting bench test()\n";
+
+        schedule(run_all());
+
+        continuation([]() { std::cout << "Ending bench test()\n"; });
+    }
+
+}
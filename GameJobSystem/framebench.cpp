@@ -0,0 +1,346 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <stdlib.h>
+#include <functional>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <tuple>
+
+
+#include "VEGameJobSystem.h"
+#include "VECoro.h"
+
+
+using namespace std::chrono;
+
+
+namespace framebench {
+
+    using namespace vgjs;
+
+    /**
+    * \brief Command line options of the frame benchmark.
+    */
+    struct Options {
+        uint32_t    m_threads = 0;          ///<0 means one per hardware thread
+        uint32_t    m_frames = 60;          ///<measured frames
+        uint32_t    m_warmup = 5;           ///<frames run before measuring
+        uint32_t    m_entities = 1 << 20;   ///<entities of the transform update and the broadphase
+        std::string m_format = "table";     ///<table, csv or json
+        std::string m_out;                  ///<output file, empty means stdout
+        bool        m_header = true;        ///<print the csv header
+    };
+
+    Options g_options;
+
+    const uint32_t c_chunk = 1 << 14;       ///<entities per transform and broadphase job
+    const uint32_t c_partitions = 64;       ///<partitions of the spatial hash, one job each
+    const uint32_t c_skeletons = 2048;      ///<one animation job per skeleton
+    const uint32_t c_bones = 64;
+    const uint32_t c_assets = 8;            ///<assets streamed per frame
+    const uint32_t c_asset_size = 1 << 16;
+    const uint32_t c_serial_jobs = 3;       ///<long jobs pinned to thread 0
+    const uint32_t c_serial_work = 1 << 18; ///<iterations of each serial job
+
+    /**
+    * \brief Entities as structure of arrays, and the per frame data of the other systems.
+    */
+    struct World {
+        std::vector<float>      m_px, m_py, m_pz, m_vx, m_vy, m_vz, m_yaw;
+        std::vector<float>      m_world;                    //3x4 matrix per entity
+        std::vector<std::vector<std::vector<std::pair<uint32_t, uint32_t>>>> m_bins;  //per chunk and partition: cell hash and entity
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> m_cells;              //per partition, sorted by cell hash
+        std::vector<float>      m_pose_a, m_pose_b, m_pose; //7 floats per bone: rotation quaternion and translation
+        std::vector<uint8_t>    m_assets;                   //compressed assets
+        std::vector<uint8_t>    m_loaded;
+        std::atomic<uint64_t>   m_checksum = 0;
+
+        World(uint32_t entities) {
+            uint32_t chunks = (entities + c_chunk - 1) / c_chunk;
+            for (auto* v : { &m_px, &m_py, &m_pz, &m_vx, &m_vy, &m_vz, &m_yaw }) v->resize(entities);
+            for (uint32_t i = 0; i < entities; ++i) {
+                m_px[i] = (float)(i % 1000) - 500.0f; m_py[i] = (float)(i / 1000 % 1000) - 500.0f; m_pz[i] = (float)(i % 997) - 498.0f;
+                m_vx[i] = (float)(i % 7) - 3.0f; m_vy[i] = (float)(i % 5) - 2.0f; m_vz[i] = (float)(i % 3) - 1.0f;
+                m_yaw[i] = (float)i;
+            }
+            m_world.resize(12 * (std::size_t)entities);
+            m_bins.resize(chunks, std::vector<std::vector<std::pair<uint32_t, uint32_t>>>(c_partitions));
+            m_cells.resize(c_partitions);
+            for (auto* v : { &m_pose_a, &m_pose_b, &m_pose }) v->resize((std::size_t)7 * c_skeletons * c_bones, 0.5f);
+            m_assets.resize((std::size_t)c_assets * c_asset_size);
+            for (std::size_t i = 0; i < m_assets.size(); ++i) m_assets[i] = (uint8_t)(i * 31);
+            m_loaded.resize(m_assets.size());
+        }
+
+        uint32_t entities() { return (uint32_t)m_px.size(); }
+    };
+
+    World* g_world = nullptr;
+
+    //---------------------------------------------------------------------------------------------------
+    //systems
+
+    /**
+    * \brief ECS style transform update of a chunk: integrate, bounce at the borders, and build the world matrix.
+    */
+    void transform(uint32_t begin, uint32_t end, float dt) {
+        World& w = *g_world;
+        for (uint32_t i = begin; i < end; ++i) {
+            w.m_px[i] += w.m_vx[i] * dt; w.m_py[i] += w.m_vy[i] * dt; w.m_pz[i] += w.m_vz[i] * dt;
+            if (std::abs(w.m_px[i]) > 500.0f) w.m_vx[i] = -w.m_vx[i];
+            if (std::abs(w.m_py[i]) > 500.0f) w.m_vy[i] = -w.m_vy[i];
+            if (std::abs(w.m_pz[i]) > 500.0f) w.m_vz[i] = -w.m_vz[i];
+            w.m_yaw[i] += 0.1f * dt;
+            float c = std::cos(w.m_yaw[i]), s = std::sin(w.m_yaw[i]);
+            float* m = &w.m_world[12 * (std::size_t)i];
+            m[0] = c;  m[1] = 0.0f; m[2] = s;     m[3] = w.m_px[i];
+            m[4] = 0;  m[5] = 1.0f; m[6] = 0.0f;  m[7] = w.m_py[i];
+            m[8] = -s; m[9] = 0.0f; m[10] = c;    m[11] = w.m_pz[i];
+        }
+    }
+
+    /**
+    * \brief First broadphase pass over a chunk: hash the cell of each entity into the bin of its partition.
+    */
+    void broadphase_bin(uint32_t chunk) {
+        World& w = *g_world;
+        auto& bins = w.m_bins[chunk];
+        for (auto& bin : bins) bin.clear();
+        uint32_t end = std::min((chunk + 1) * c_chunk, w.entities());
+        for (uint32_t i = chunk * c_chunk; i < end; ++i) {
+            int32_t x = (int32_t)std::floor(w.m_px[i] / 8.0f), y = (int32_t)std::floor(w.m_py[i] / 8.0f), z = (int32_t)std::floor(w.m_pz[i] / 8.0f);
+            uint32_t hash = (uint32_t)(x * 73856093) ^ (uint32_t)(y * 19349663) ^ (uint32_t)(z * 83492791);
+            bins[hash % c_partitions].push_back({ hash, i });
+        }
+    }
+
+    /**
+    * \brief Second broadphase pass: gather the bins of a partition from all chunks and sort them by cell.
+    */
+    void broadphase_sort(uint32_t partition) {
+        World& w = *g_world;
+        auto& cells = w.m_cells[partition];
+        cells.clear();
+        for (auto& bins : w.m_bins) cells.insert(cells.end(), bins[partition].begin(), bins[partition].end());
+        std::sort(cells.begin(), cells.end());
+    }
+
+    /**
+    * \brief Blend two poses of a skeleton, normalized lerp of the rotations and lerp of the translations.
+    */
+    void animate(uint32_t skeleton, float t) {
+        World& w = *g_world;
+        for (uint32_t b = 0; b < c_bones; ++b) {
+            std::size_t i = 7 * ((std::size_t)skeleton * c_bones + b);
+            float* a = &w.m_pose_a[i], * bp = &w.m_pose_b[i], * out = &w.m_pose[i];
+            float len = 0.0f;
+            for (uint32_t k = 0; k < 4; ++k) { out[k] = a[k] + (bp[k] - a[k]) * t; len += out[k] * out[k]; }
+            len = 1.0f / std::sqrt(len);
+            for (uint32_t k = 0; k < 4; ++k) out[k] *= len;
+            for (uint32_t k = 4; k < 7; ++k) out[k] = a[k] + (bp[k] - a[k]) * t;
+        }
+    }
+
+    /**
+    * \brief A long serial job, e.g. game logic or audio mixing, that must run on the main thread.
+    */
+    void serial(uint32_t seed) {
+        uint64_t x = seed + 1;
+        for (uint32_t i = 0; i < c_serial_work; ++i) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        }
+        g_world->m_checksum += x;
+    }
+
+    /**
+    * \brief Stream an asset: checksum and decode its bytes.
+    */
+    Coro<int> load_asset(uint32_t asset) {
+        World& w = *g_world;
+        uint32_t hash = 2166136261u;
+        std::size_t begin = (std::size_t)asset * c_asset_size;
+        for (std::size_t i = begin; i < begin + c_asset_size; ++i) {
+            hash = (hash ^ w.m_assets[i]) * 16777619u;
+            w.m_loaded[i] = w.m_assets[i] ^ (uint8_t)hash;
+        }
+        co_return (int)hash;
+    }
+
+    Coro<int> stream() {
+        std::pmr::vector<Coro<int>> assets;
+        for (uint32_t a = 0; a < c_assets; ++a) assets.emplace_back(load_asset(a));
+        co_await assets;
+        int sum = 0;
+        for (auto& asset : assets) sum += asset.get().second;
+        co_return sum;
+    }
+
+    /**
+    * \brief The simulation: transforms, then broadphase binning and animation in parallel, then the broadphase sort.
+    */
+    Coro<int> simulate(float dt) {
+        uint32_t n = g_world->entities();
+        std::pmr::vector<Function> transforms;
+        for (uint32_t begin = 0; begin < n; begin += c_chunk) {
+            transforms.emplace_back(Function{ [=]() { transform(begin, std::min(begin + c_chunk, n), dt); } });
+        }
+        co_await transforms;
+
+        auto bin_and_animate = std::make_tuple(std::pmr::vector<Function>{}, std::pmr::vector<Function>{});
+        for (uint32_t chunk = 0; chunk < (n + c_chunk - 1) / c_chunk; ++chunk) {
+            std::get<0>(bin_and_animate).emplace_back(Function{ [=]() { broadphase_bin(chunk); } });
+        }
+        for (uint32_t s = 0; s < c_skeletons; ++s) {
+            std::get<1>(bin_and_animate).emplace_back(Function{ [=]() { animate(s, dt); } });
+        }
+        co_await bin_and_animate;
+
+        std::pmr::vector<Function> sorts;
+        for (uint32_t p = 0; p < c_partitions; ++p) {
+            sorts.emplace_back(Function{ [=]() { broadphase_sort(p); } });
+        }
+        co_await sorts;
+        co_return 0;
+    }
+
+    /**
+    * \brief One frame: the pinned serial jobs, asset streaming and the simulation all run at the same time.
+    */
+    Coro<> frame(uint32_t number) {
+        auto work = std::make_tuple(std::pmr::vector<Function>{}, std::pmr::vector<Coro<int>>{}, std::pmr::vector<Coro<int>>{});
+        for (uint32_t i = 0; i < c_serial_jobs; ++i) {
+            std::get<0>(work).emplace_back(Function{ [=]() { serial(number * c_serial_jobs + i); }, 0 });   //thread 0
+        }
+        std::get<1>(work).emplace_back(stream());
+        std::get<2>(work).emplace_back(simulate(1.0f / 60.0f));
+        co_await work;
+        co_return;
+    }
+
+    //---------------------------------------------------------------------------------------------------
+    //measuring
+
+    /**
+    * \brief Frame time distribution and core utilization of a run.
+    */
+    struct Result {
+        uint32_t    m_threads = 0;
+        uint32_t    m_frames = 0;
+        uint32_t    m_entities = 0;
+        double      m_mean_ms = 0.0;
+        double      m_p50_ms = 0.0;
+        double      m_p99_ms = 0.0;
+        double      m_max_ms = 0.0;
+        double      m_utilization = 0.0;    ///<share of the thread time spent running jobs
+    };
+
+    void print(std::ostream& out, Result& r) {
+        if (g_options.m_format == "csv") {
+            if (g_options.m_header) out << "threads,frames,entities,mean_ms,p50_ms,p99_ms,max_ms,utilization\n";
+            out << r.m_threads << "," << r.m_frames << "," << r.m_entities << "," << r.m_mean_ms << "," << r.m_p50_ms << ","
+                << r.m_p99_ms << "," << r.m_max_ms << "," << r.m_utilization << "\n";
+        }
+        else if (g_options.m_format == "json") {
+            out << "{\"threads\": " << r.m_threads << ", \"frames\": " << r.m_frames << ", \"entities\": " << r.m_entities
+                << ", \"mean_ms\": " << r.m_mean_ms << ", \"p50_ms\": " << r.m_p50_ms << ", \"p99_ms\": " << r.m_p99_ms
+                << ", \"max_ms\": " << r.m_max_ms << ", \"utilization\": " << r.m_utilization << "}\n";
+        }
+        else {
+            out << std::fixed << std::setprecision(2);
+            out << "frame benchmark, " << r.m_threads << " threads, " << r.m_frames << " frames, " << r.m_entities << " entities\n";
+            out << "  frame ms mean " << r.m_mean_ms << " p50 " << r.m_p50_ms << " p99 " << r.m_p99_ms << " max " << r.m_max_ms << "\n";
+            out << "  utilization " << 100.0 * r.m_utilization << "%\n";
+        }
+    }
+
+    /**
+    * \brief Run the warmup and the measured frames, print the results and terminate the job system.
+    */
+    Coro<> run_frames() {
+        std::vector<double> times;
+        std::vector<JobStats> last;
+        for (uint32_t f = 0; f < g_options.m_warmup + g_options.m_frames; ++f) {
+            if (f == g_options.m_warmup) JobSystem::instance().stats_delta(last);   //start counting
+            auto next = frame(f);
+            auto t1 = high_resolution_clock::now();
+            co_await next;
+            auto t2 = high_resolution_clock::now();
+            if (f >= g_options.m_warmup) times.push_back(duration_cast<nanoseconds>(t2 - t1).count() / 1.0e6);
+        }
+        JobStats total;
+        for (auto& s : JobSystem::instance().stats_delta(last)) total += s;
+
+        Result r;
+        r.m_threads = JobSystem::instance().worker_count();
+        r.m_frames = (uint32_t)times.size();
+        r.m_entities = g_world->entities();
+        if (!times.empty()) {
+            for (auto t : times) r.m_mean_ms += t / times.size();
+            std::sort(times.begin(), times.end());
+            auto percentile = [&](double p) { return times[std::min(times.size() - 1, (std::size_t)std::ceil(p * times.size()) - 1)]; };
+            r.m_p50_ms = percentile(0.5);
+            r.m_p99_ms = percentile(0.99);
+            r.m_max_ms = times.back();
+        }
+        uint64_t all = total.m_busy_ns + total.m_idle_ns;
+        r.m_utilization = all > 0 ? (double)total.m_busy_ns / all : 0.0;
+
+        if (g_options.m_out.empty()) {
+            print(std::cout, r);
+        }
+        else {
+            std::ofstream out(g_options.m_out, std::ios::app);
+            print(out, r);
+        }
+        vgjs::terminate();
+        co_return;
+    }
+
+    /**
+    * \brief Parse the options, start the job system and run the frames.
+    *
+    * Options: --threads N, --frames N, --warmup N, --entities N, --csv, --json, --no-header, --out file.
+    * The job system can be started only once, so run once per thread count to compare thread counts.
+    *
+    * \returns the exit code.
+    */
+    int run(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool value = i + 1 < argc;
+            if (arg == "--threads" && value) g_options.m_threads = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--frames" && value) g_options.m_frames = std::max((uint32_t)std::stoul(argv[++i]), 1u);
+            else if (arg == "--warmup" && value) g_options.m_warmup = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--entities" && value) g_options.m_entities = std::max((uint32_t)std::stoul(argv[++i]), 1u);
+            else if (arg == "--out" && value) g_options.m_out = argv[++i];
+            else if (arg == "--csv") g_options.m_format = "csv";
+            else if (arg == "--json") g_options.m_format = "json";
+            else if (arg == "--no-header") g_options.m_header = false;
+            else {
+                std::cerr << "unknown option " << arg << "\n";
+                return 1;
+            }
+        }
+
+        World world(g_options.m_entities);
+        g_world = &world;
+        JobSystem::instance(g_options.m_threads);
+        schedule(run_frames());
+        wait_for_termination();
+        g_world = nullptr;
+        return 0;
+    }
+
+}
+
+
+#if defined(VGJS_FRAME_MAIN)    //standalone executable, e.g. g++ -std=c++20 -O2 -DVGJS_FRAME_MAIN framebench.cpp -pthread
+
+int main(int argc, char* argv[]) {
+    return framebench::run(argc, argv);
+}
+
+#endif
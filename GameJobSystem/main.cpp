@@ -25,6 +25,19 @@ namespace docu {
 	void test(int);
 }
 
+namespace bench {
+	void queues();
+	void test();
+}
+
+namespace microbench {
+	int run(int argc, char* argv[]);
+}
+
+namespace framebench {
+	int run(int argc, char* argv[]);
+}
+
 
 void driver( int i ) {
 
@@ -40,10 +53,39 @@ void driver( int i ) {
 	}
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	using namespace vgjs;
 
+	if (argc >= 2 && std::string(argv[1]) == "--bench") {	//microbenchmarks: --bench [--threads N] [--csv|--json] [--out file]
+		return microbench::run(argc - 1, argv + 1);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "--frame") {	//frame benchmark: --frame [--threads N] [--frames N] [--csv|--json] [--out file]
+		return framebench::run(argc - 1, argv + 1);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "--features") {	//benchmarks of single features: queue false sharing, large results, job size, tracing
+		bench::queues();	//needs no job system
+		JobSystem::instance();
+		schedule([]() {
+			schedule([]() { bench::test(); });
+			continuation([]() { vgjs::terminate(); });	//runs after bench::test() and all its children
+		});
+		wait_for_termination();
+		return 0;
+	}
+	if (argc == 4 && std::string(argv[1]) == "--convert") {	//convert a binary trace file: --convert log.bin log.json
+		return convert_trace(argv[2], argv[3]) ? 0 : 1;
+	}
+	if (argc >= 3 && std::string(argv[1]) == "--critical-path") {	//--critical-path log.bin [from_ms to_ms]
+		CriticalPath path;
+		std::map<int32_t, std::string> types;
+		double from = argc >= 5 ? std::stod(argv[3]) * 1.0e6 : 0.0;
+		double to = argc >= 5 ? std::stod(argv[4]) * 1.0e6 : std::numeric_limits<double>::max();
+		if (!analyze_trace(argv[2], path, types, from, to)) return 1;
+		print_critical_path(std::cout, path, types);
+		return 0;
+	}
+
 	JobSystem::instance();
 
 	//schedule( [](){ driver(1000); });
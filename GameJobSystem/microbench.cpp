@@ -0,0 +1,703 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <stdlib.h>
+#include <functional>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <sstream>
+
+
+#include "VEGameJobSystem.h"
+#include "VECoro.h"
+
+
+using namespace std::chrono;
+
+
+namespace microbench {
+
+    using namespace vgjs;
+
+    /**
+    * \brief Best time of one scenario.
+    */
+    struct Result {
+        std::string m_name;         ///<name of the scenario
+        uint32_t    m_threads = 0;  ///<number of threads of the job system
+        uint64_t    m_jobs = 0;     ///<jobs, coros, awaits or hops in one run
+        double      m_ns = 0.0;     ///<best time of all runs
+        double      m_median_ns = 0.0;      ///<median time of all runs
+        double      m_mad_ns = 0.0;         ///<median absolute deviation of the times from the median
+        double      m_steal_attempts = 0.0; ///<per run, from JobStats
+        double      m_steals = 0.0;         ///<per run
+        double      m_contended = 0.0;      ///<queue locks found taken per run, needs VGJS_LOCK_STATS
+        uint64_t    m_retired_peak = 0;     ///<highest number of retired jobs not yet freed, since the job system started
+
+        double ns_per_job() const noexcept { return m_jobs > 0 ? m_ns / m_jobs : 0.0; };
+        double jobs_per_s() const noexcept { return m_ns > 0.0 ? 1.0e9 * m_jobs / m_ns : 0.0; };
+        double median_ns_per_job() const noexcept { return m_jobs > 0 ? m_median_ns / m_jobs : 0.0; };
+        double mad_ns_per_job() const noexcept { return m_jobs > 0 ? m_mad_ns / m_jobs : 0.0; };
+    };
+
+    /**
+    * \brief Stored result of a scenario, compared against the current one by the regression gate.
+    */
+    struct Baseline {
+        std::string m_name;
+        uint32_t    m_threads = 0;
+        double      m_median = 0.0;         ///<median ns per job
+        double      m_mad = 0.0;            ///<median absolute deviation in ns per job
+        double      m_tolerance = 0.0;      ///<allowed relative slowdown, 0 means the --tolerance option
+    };
+
+    /**
+    * \brief Command line options of the benchmark.
+    */
+    struct Options {
+        uint32_t    m_threads = 0;          ///<0 means one per hardware thread
+        uint32_t    m_runs = 5;             ///<runs per scenario, the best one counts
+        uint32_t    m_scale = 1;            ///<multiplies the number of jobs of each scenario
+        std::string m_format = "table";     ///<table, csv or json
+        std::string m_out;                  ///<output file, empty means stdout
+        bool        m_header = true;        ///<print the csv header
+        bool        m_scaling = false;      ///<run all scenarios for 1, 2, 4, ... threads
+        uint32_t    m_max_threads = 0;      ///<highest thread count of the scaling runs, 0 means hardware threads
+        std::string m_baseline;             ///<compare against this JSON file, written before with --json
+        double      m_tolerance = 0.1;      ///<allowed relative slowdown if the baseline gives none
+        bool        m_allow_missing = false;    ///<scenarios of the baseline that did not run do not fail the gate
+    };
+
+    Options g_options;
+    std::vector<Result> g_results;
+    int g_exit = 0;                         ///<exit code, 1 if the regression gate or the retired job check failed
+
+    double median(std::vector<double> values) {
+        if (values.empty()) return 0.0;
+        std::sort(values.begin(), values.end());
+        std::size_t n = values.size();
+        return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+    }
+
+    /**
+    * \brief Run a scenario several times and remember the best and median time, the noise, and the mean steal and lock counts.
+    * \param[in] name Name of the scenario.
+    * \param[in] jobs Number of jobs in one run.
+    * \param[in] make Returns a Coro<> running the scenario once.
+    */
+    template<typename F>
+    Coro<> measure(std::string name, uint64_t jobs, F make) {
+        std::vector<double> times;
+        std::vector<JobStats> last;
+        JobSystem::instance().stats_delta(last);
+        for (uint32_t run = 0; run < g_options.m_runs; ++run) {
+            auto scenario = make();
+            auto t1 = high_resolution_clock::now();
+            co_await scenario;
+            auto t2 = high_resolution_clock::now();
+            times.push_back((double)duration_cast<nanoseconds>(t2 - t1).count());
+        }
+        double best = *std::min_element(times.begin(), times.end());
+        double med = median(times);
+        for (auto& t : times) t = std::abs(t - med);
+        JobStats total;
+        for (auto& s : JobSystem::instance().stats_delta(last)) total += s;
+        double runs = g_options.m_runs;
+        uint64_t contended = total.m_local_lock.m_contended + total.m_global_lock.m_contended + total.m_recycle_lock.m_contended;
+        uint64_t retired = JobSystem::instance().retired_peak() / sizeof(Job);
+        g_results.push_back({ name, JobSystem::instance().worker_count(), jobs, best, med, median(times), total.m_steal_attempts / runs, total.m_steals / runs, contended / runs, retired });
+        co_return;
+    }
+
+    //---------------------------------------------------------------------------------------------------
+    //scenarios, each runs once
+
+    /**
+    * \brief Push and pop items through a JobQueue on one thread, the cost of the queue and its lock alone.
+    */
+    Coro<> queue_push_pop(uint32_t n) {
+        auto ops = [=]() {
+            JobQueue<Queuable> queue;
+            std::vector<Queuable> items(1024);
+            for (uint32_t i = 0; i < n; i += (uint32_t)items.size()) {
+                for (auto& item : items) queue.push(&item);
+                while (queue.pop() != nullptr);
+            }
+        };
+        co_await ops;
+        co_return;
+    }
+
+    /**
+    * \brief Empty jobs scheduled by one job per thread, so that all threads schedule and run.
+    */
+    Coro<> empty_jobs(uint32_t n) {
+        uint32_t parts = JobSystem::instance().worker_count();
+        auto spread = [=]() {
+            for (uint32_t p = 0; p < parts; ++p) {
+                schedule([=]() { for (uint32_t i = 0; i < n / parts; ++i) schedule([]() {}); });
+            }
+        };
+        co_await spread;
+        co_return;
+    }
+
+    /**
+    * \brief Empty jobs all scheduled one by one by a single job.
+    */
+    Coro<> fan_out(uint32_t n) {
+        auto fan = [=]() { for (uint32_t i = 0; i < n; ++i) schedule([]() {}); };
+        co_await fan;
+        co_return;
+    }
+
+    /**
+    * \brief Binary tree of coros, each awaiting a vector of its two children, like coro::recursive2.
+    */
+    Coro<int> tree(uint32_t depth) {
+        if (depth > 1) {
+            std::pmr::vector<Coro<int>> children;
+            children.emplace_back(tree(depth - 1));
+            children.emplace_back(tree(depth - 1));
+            co_await children;
+        }
+        co_return 0;
+    }
+
+    Coro<> coro_tree(uint32_t depth) {
+        auto root = tree(depth);
+        co_await root;
+        co_return;
+    }
+
+    /**
+    * \brief Recursive Fibonacci with function jobs, each scheduling its two children.
+    */
+    void fib(uint32_t n) {
+        if (n < 2) return;
+        schedule([=]() { fib(n - 1); });
+        schedule([=]() { fib(n - 2); });
+    }
+
+    uint64_t fib_jobs(uint32_t n) {     ///<number of jobs run by fib(n)
+        uint64_t a = 1, b = 1;          //jobs for n-2 and n-1
+        for (uint32_t i = 2; i <= n; ++i) {
+            uint64_t c = 1 + a + b;
+            a = b;
+            b = c;
+        }
+        return b;
+    }
+
+    Coro<> function_fib(uint32_t n) {
+        auto root = [=]() { fib(n); };
+        co_await root;
+        co_return;
+    }
+
+    /**
+    * \brief Await n trivial coros one after the other, measuring the round trip of co_await.
+    */
+    Coro<int> leaf() {
+        co_return 1;
+    }
+
+    Coro<> await_latency(uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i) {
+            auto child = leaf();
+            co_await child;
+        }
+        co_return;
+    }
+
+    /**
+    * \brief Like await_latency, but the child runs inline on the awaiting thread, half coros and half functions.
+    */
+    Coro<> inline_await(uint32_t n) {
+        for (uint32_t i = 0; i < n / 2; ++i) {
+            auto child = leaf();
+            co_await inlined(child);
+            Function f{ []() {} };
+            co_await inlined(f);
+        }
+        co_return;
+    }
+
+    /**
+    * \brief A chain of n coros, each awaiting the next one. When the last one finishes, the
+    * whole chain finishes from the inside out, each coro resuming its parent.
+    */
+    Coro<int> link(uint32_t n) {
+        if (n > 1) {
+            auto next = link(n - 1);
+            co_await next;
+        }
+        co_return 0;
+    }
+
+    Coro<> await_chain(uint32_t n) {
+        auto head = link(n);
+        co_await head;
+        co_return;
+    }
+
+    /**
+    * \brief n races of four trivial coros each, awaiting only the first to finish with when_any.
+    */
+    Coro<> race_await(uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i) {
+            std::pmr::vector<Coro<int>> racers;
+            for (uint32_t j = 0; j < 4; ++j) {
+                racers.emplace_back(leaf());
+            }
+            co_await when_any(racers);
+        }
+        co_return;
+    }
+
+    /**
+    * \brief A result that can only be moved and has no default constructor.
+    */
+    struct Ticket {
+        explicit Ticket(uint32_t id) noexcept : m_id{ std::make_unique<uint32_t>(id) } {};
+        std::unique_ptr<uint32_t> m_id;   //owned, so a Ticket cannot be copied
+    };
+
+    Coro<Ticket> ticket(uint32_t id) {
+        co_return Ticket{ id };
+    }
+
+    /**
+    * \brief n races of four coros returning a Ticket, the winner's Ticket is moved out of the race.
+    */
+    Coro<> race_move_only(uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i) {
+            std::pmr::vector<Coro<Ticket>> racers;
+            for (uint32_t j = 0; j < 4; ++j) {
+                racers.emplace_back(ticket(j));
+            }
+            auto [index, winner] = co_await when_any(racers);
+            assert(winner.m_id && *winner.m_id == index);
+        }
+        co_return;
+    }
+
+    /**
+    * \brief Move the coro from thread to thread with co_await thread_index.
+    */
+    Coro<> thread_hops(uint32_t n) {
+        uint32_t threads = JobSystem::instance().worker_count();
+        for (uint32_t i = 0; i < n; ++i) {
+            co_await (int)((i + 1) % threads);
+        }
+        co_return;
+    }
+
+    /**
+    * \brief n empty jobs run by the other threads while thread 0 is busy with one long pinned job, like
+    * render submission. Surplus jobs must still be freed meanwhile, so the peak of retired jobs stays bounded,
+    * which check_retired() tests after all scenarios ran.
+    */
+    Coro<> pinned_long_job(uint32_t n) {
+        std::atomic<uint32_t> done = 0;
+        std::pmr::vector<Function> jobs;
+        jobs.emplace_back(Function{ [&]() { while (done.load() < n) {} }, 0 });
+        jobs.emplace_back(Function{ [&, n]() { for (uint32_t i = 0; i < n; ++i) schedule([&]() { done++; }); }, 1 });
+        co_await jobs;
+        co_return;
+    }
+
+    /**
+    * \brief A function job followed by a chain of n continuations.
+    */
+    void chain(uint32_t n) {
+        if (n > 0) continuation([=]() { chain(n - 1); });
+    }
+
+    Coro<> continuation_chain(uint32_t n) {
+        auto head = [=]() { chain(n); };
+        co_await head;
+        co_return;
+    }
+
+    /**
+    * \brief Await a vector of n coros.
+    */
+    Coro<> vector_await(uint32_t n) {
+        std::pmr::vector<Coro<int>> coros;
+        for (uint32_t i = 0; i < n; ++i) coros.emplace_back(leaf());
+        co_await coros;
+        co_return;
+    }
+
+    /**
+    * \brief Await a tuple of a vector of coros and a vector of functions, n jobs in total.
+    */
+    Coro<> tuple_await(uint32_t n) {
+        auto tuple = std::make_tuple(std::pmr::vector<Coro<int>>{}, std::pmr::vector<Function>{});
+        for (uint32_t i = 0; i < n / 2; ++i) {
+            std::get<0>(tuple).emplace_back(leaf());
+            std::get<1>(tuple).emplace_back(Function{ []() {} });
+        }
+        co_await tuple;
+        co_return;
+    }
+
+    //---------------------------------------------------------------------------------------------------
+    //output
+
+    /**
+    * \brief Print the results as a table, as CSV or as JSON.
+    */
+    void print(std::ostream& out) {
+        if (g_options.m_format == "csv") {
+            if (g_options.m_header) out << "name,threads,jobs,ns_per_job,jobs_per_s,retired_peak\n";
+            for (auto& r : g_results) {
+                out << r.m_name << "," << r.m_threads << "," << r.m_jobs << "," << r.ns_per_job() << "," << (uint64_t)r.jobs_per_s() << "," << r.m_retired_peak << "\n";
+            }
+        }
+        else if (g_options.m_format == "json") {
+            out << "[\n";
+            for (std::size_t i = 0; i < g_results.size(); ++i) {
+                auto& r = g_results[i];
+                out << "  {\"name\": \"" << r.m_name << "\", \"threads\": " << r.m_threads << ", \"jobs\": " << r.m_jobs
+                    << ", \"ns_per_job\": " << r.ns_per_job() << ", \"jobs_per_s\": " << (uint64_t)r.jobs_per_s()
+                    << ", \"median_ns_per_job\": " << r.median_ns_per_job() << ", \"mad_ns_per_job\": " << r.mad_ns_per_job()
+                    << ", \"retired_peak\": " << r.m_retired_peak
+                    << ", \"tolerance\": " << g_options.m_tolerance << "}"
+                    << (i + 1 < g_results.size() ? ",\n" : "\n");
+            }
+            out << "]\n";
+        }
+        else {
+            out << std::left << std::setw(20) << "scenario" << std::right << std::setw(8) << "threads" << std::setw(10) << "jobs"
+                << std::setw(12) << "ns/job" << std::setw(14) << "jobs/s" << std::setw(9) << "retired" << "\n";
+            for (auto& r : g_results) {
+                out << std::left << std::setw(20) << r.m_name << std::right << std::setw(8) << r.m_threads << std::setw(10) << r.m_jobs
+                    << std::setw(12) << std::fixed << std::setprecision(1) << r.ns_per_job() << std::setw(14) << (uint64_t)r.jobs_per_s()
+                    << std::setw(9) << r.m_retired_peak << "\n";
+            }
+        }
+    }
+
+    /**
+    * \brief Run all scenarios one after the other.
+    */
+    Coro<> run_scenarios() {
+        uint32_t s = g_options.m_scale;
+        uint32_t depth = 14, fib_n = 20;
+        while ((1u << (depth - 14)) < s) ++depth;   //grow the trees with the scale
+        while (fib_jobs(fib_n) < fib_jobs(20) * s) ++fib_n;
+
+        auto m0 = measure("queue_push_pop", (1 << 20) * s, [=]() { return queue_push_pop((1 << 20) * s); });
+        co_await m0;
+        auto m1 = measure("empty_jobs", (1 << 16) * s, [=]() { return empty_jobs((1 << 16) * s); });
+        co_await m1;
+        auto m2 = measure("fan_out", (1 << 16) * s, [=]() { return fan_out((1 << 16) * s); });
+        co_await m2;
+        auto m3 = measure("coro_tree", (1ull << depth) - 1, [=]() { return coro_tree(depth); });
+        co_await m3;
+        auto m4 = measure("function_fib", fib_jobs(fib_n), [=]() { return function_fib(fib_n); });
+        co_await m4;
+        auto m5 = measure("await_latency", 4096 * s, [=]() { return await_latency(4096 * s); });
+        co_await m5;
+        auto m11 = measure("inline_await", 4096 * s, [=]() { return inline_await(4096 * s); });
+        co_await m11;
+        auto m10 = measure("await_chain", 4096 * s, [=]() { return await_chain(4096 * s); });
+        co_await m10;
+        auto m12 = measure("when_any", 4096 * s, [=]() { return race_await(4096 * s); });
+        co_await m12;
+        auto m14 = measure("when_any_move_only", 4096 * s, [=]() { return race_move_only(4096 * s); });
+        co_await m14;
+        if (JobSystem::instance().worker_count() > 1) {    //with one thread there is nowhere to hop
+            auto m6 = measure("thread_hops", 4096 * s, [=]() { return thread_hops(4096 * s); });
+            co_await m6;
+            auto m13 = measure("pinned_long_job", (1 << 16) * s, [=]() { return pinned_long_job((1 << 16) * s); });
+            co_await m13;
+        }
+        auto m7 = measure("continuation_chain", 4096 * s, [=]() { return continuation_chain(4096 * s); });
+        co_await m7;
+        auto m8 = measure("vector_await", (1 << 14) * s, [=]() { return vector_await((1 << 14) * s); });
+        co_await m8;
+        auto m9 = measure("tuple_await", (1 << 14) * s, [=]() { return tuple_await((1 << 14) * s); });
+        co_await m9;
+        co_return;
+    }
+
+    //---------------------------------------------------------------------------------------------------
+    //regression gate
+
+    /**
+    * \brief Get the value of a key from a JSON object written by print().
+    * \returns the value without quotes, or an empty string.
+    */
+    std::string json_value(const std::string& object, const std::string& key) {
+        auto pos = object.find("\"" + key + "\":");
+        if (pos == std::string::npos) return {};
+        pos = object.find_first_not_of(" ", pos + key.size() + 3);
+        if (pos == std::string::npos) return {};
+        if (object[pos] == '"') return object.substr(pos + 1, object.find('"', pos + 1) - pos - 1);
+        return object.substr(pos, object.find_first_of(",}", pos) - pos);
+    }
+
+    /**
+    * \brief Read a baseline, i.e. the output of --json of an earlier run.
+    * Each entry may carry its own "tolerance", which can be edited by hand.
+    * \returns the baselines, empty if the file cannot be read.
+    */
+    std::vector<Baseline> read_baseline(const std::string& file) {
+        std::ifstream in(file);
+        std::stringstream text;
+        text << in.rdbuf();
+        std::string json = text.str();
+        std::vector<Baseline> baselines;
+        for (std::size_t begin = json.find('{'); begin != std::string::npos; begin = json.find('{', begin + 1)) {
+            std::string object = json.substr(begin, json.find('}', begin) - begin + 1);
+            std::string median = json_value(object, "median_ns_per_job");
+            if (median.empty()) continue;
+            Baseline b{ json_value(object, "name"), (uint32_t)std::stoul("0" + json_value(object, "threads")), std::stod(median) };
+            std::string mad = json_value(object, "mad_ns_per_job"), tolerance = json_value(object, "tolerance");
+            if (!mad.empty()) b.m_mad = std::stod(mad);
+            if (!tolerance.empty()) b.m_tolerance = std::stod(tolerance);
+            baselines.push_back(b);
+        }
+        return baselines;
+    }
+
+    /**
+    * \brief Compare the median ns/job of each scenario with the baseline.
+    *
+    * A scenario is slower if its median exceeds the baseline by more than the tolerance, and also by more
+    * than three standard deviations estimated from the larger MAD, so that noise alone does not fail the gate.
+    * Only if it is not slower, a MAD of the current runs larger than the tolerance marks it as too noisy to
+    * tell whether it got faster. Scenarios of the baseline that did not run fail the gate, unless --allow-missing is given.
+    * queue_push_pop covers JobQueue, empty_jobs and fan_out allocate_job() and recycling, function_fib and
+    * continuation_chain child_finished() and on_finished(), and the await scenarios the coro awaiters.
+    *
+    * \returns the number of slower and missing scenarios.
+    */
+    int compare_baseline(std::ostream& out, const std::vector<Baseline>& baselines) {
+        int slower = 0, missing = 0;
+        out << std::left << std::setw(20) << "scenario" << std::right << std::setw(8) << "threads" << std::setw(12) << "base ns"
+            << std::setw(12) << "ns/job" << std::setw(10) << "change" << std::setw(11) << "tolerance" << "  status\n";
+        for (auto& r : g_results) {
+            auto b = std::find_if(baselines.begin(), baselines.end(), [&](auto& b) { return b.m_name == r.m_name && b.m_threads == r.m_threads; });
+            out << std::left << std::setw(20) << r.m_name << std::right << std::setw(8) << r.m_threads << std::fixed << std::setprecision(1);
+            if (b == baselines.end()) {
+                out << std::setw(12) << "-" << std::setw(12) << r.median_ns_per_job() << std::setw(10) << "-" << std::setw(11) << "-" << "  new\n";
+                continue;
+            }
+            double tolerance = b->m_tolerance > 0.0 ? b->m_tolerance : g_options.m_tolerance;
+            double current = r.median_ns_per_job();
+            double change = current / b->m_median - 1.0;
+            double sigma = 1.4826 * std::max(r.mad_ns_per_job(), b->m_mad);   //MAD to standard deviation of a normal distribution
+            std::string status = "ok";
+            if (change > tolerance && current - b->m_median > 3.0 * sigma) { status = "SLOWER"; ++slower; }
+            else if (r.mad_ns_per_job() > tolerance * current) status = "noisy";
+            else if (change < -tolerance && b->m_median - current > 3.0 * sigma) status = "faster";
+            out << std::setw(12) << b->m_median << std::setw(12) << current << std::setw(9) << 100.0 * change << "%"
+                << std::setw(10) << 100.0 * tolerance << "%" << "  " << status << "\n";
+        }
+        for (auto& b : baselines) {
+            if (std::none_of(g_results.begin(), g_results.end(), [&](auto& r) { return b.m_name == r.m_name && b.m_threads == r.m_threads; })) {
+                out << std::left << std::setw(20) << b.m_name << std::right << std::setw(8) << b.m_threads << (g_options.m_allow_missing ? "  missing\n" : "  MISSING\n");
+                if (!g_options.m_allow_missing) ++missing;
+            }
+        }
+        out << (slower + missing > 0 ? "FAILED: " : "passed: ") << slower << " scenarios slower than the baseline, " << missing << " missing\n";
+        return slower + missing;
+    }
+
+    /**
+    * \brief Check that surplus jobs were freed while thread 0 was busy with pinned_long_job.
+    * This is not a timing, so it is tested once after all scenarios ran, and not by the regression gate.
+    * \returns false if the peak of retired jobs exceeded 1/16 of the jobs of one run of pinned_long_job.
+    */
+    bool check_retired(std::ostream& out) {
+        for (auto& r : g_results) {
+            if (r.m_name == "pinned_long_job" && r.m_retired_peak > r.m_jobs / 16) {
+                out << "pinned_long_job: " << r.m_retired_peak << " retired jobs were not freed while thread 0 was busy\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+    * \brief Run all scenarios, print the results or compare them with the baseline, check the retired jobs, and terminate the job system.
+    */
+    Coro<> run_all() {
+        auto scenarios = run_scenarios();
+        co_await scenarios;
+
+        if (!check_retired(std::cerr)) {
+            g_exit = 1;
+        }
+
+        if (!g_options.m_baseline.empty()) {
+            auto baselines = read_baseline(g_options.m_baseline);
+            if (baselines.empty()) {
+                std::cerr << "cannot read baseline " << g_options.m_baseline << "\n";
+                g_exit = 1;
+            }
+            else if (compare_baseline(std::cout, baselines) > 0) {
+                g_exit = 1;
+            }
+        }
+
+        if (!g_options.m_out.empty()) {     //csv rows are appended, a json file is replaced, e.g. a new baseline
+            std::ofstream out(g_options.m_out, g_options.m_format == "json" ? std::ios::trunc : std::ios::app);
+            print(out);
+        }
+        else if (g_options.m_baseline.empty()) {
+            print(std::cout);
+        }
+        vgjs::terminate();
+        co_return;
+    }
+
+    //---------------------------------------------------------------------------------------------------
+    //scaling over the number of threads
+
+    /**
+    * \brief Speedup of a result over the same scenario with one thread.
+    * \returns the speedup, or 0 if the scenario did not run with one thread.
+    */
+    double speedup(const Result& r) {
+        for (auto& base : g_results) {
+            if (base.m_name == r.m_name && base.m_threads == 1) return r.jobs_per_s() / base.jobs_per_s();
+        }
+        return 0.0;
+    }
+
+    /**
+    * \brief Print a table of throughput, speedup, efficiency and steal and lock counts per scenario and thread count.
+    */
+    void print_scaling(std::ostream& out) {
+        out << std::left << std::setw(20) << "scenario" << std::right << std::setw(8) << "threads" << std::setw(14) << "jobs/s"
+            << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << std::setw(14) << "steals/run" << std::setw(14) << "contended/run" << "\n";
+        for (auto& r : g_results) {
+            double sp = speedup(r);
+            out << std::left << std::setw(20) << r.m_name << std::right << std::setw(8) << r.m_threads << std::setw(14) << (uint64_t)r.jobs_per_s()
+                << std::fixed << std::setprecision(2) << std::setw(10) << sp << std::setw(12) << sp / r.m_threads
+                << std::setprecision(0) << std::setw(14) << r.m_steals << std::setw(14) << r.m_contended << "\n";
+        }
+    }
+
+    /**
+    * \brief Write the scaling results as CSV, and a gnuplot script drawing the speedup of each scenario against the ideal one.
+    * \param[in] csv Name of the CSV file, the script gets the same name with extension .gp.
+    */
+    void write_scaling(const std::string& csv) {
+        std::ofstream out(csv);
+        out << "name,threads,jobs,ns_per_job,jobs_per_s,speedup,efficiency,steal_attempts,steals,contended\n";
+        for (auto& r : g_results) {
+            double sp = speedup(r);
+            out << r.m_name << "," << r.m_threads << "," << r.m_jobs << "," << r.ns_per_job() << "," << (uint64_t)r.jobs_per_s() << ","
+                << sp << "," << sp / r.m_threads << "," << r.m_steal_attempts << "," << r.m_steals << "," << r.m_contended << "\n";
+        }
+
+        std::string names;      //scenarios that ran with one thread
+        for (auto& r : g_results) {
+            if (r.m_threads == 1) names += (names.empty() ? "" : " ") + r.m_name;
+        }
+        std::string gp = csv.substr(0, csv.rfind('.')) + ".gp";
+        std::ofstream plot(gp);
+        plot << "set datafile separator ','\n"
+             << "set title 'Speedup over one thread'\n"
+             << "set xlabel 'threads'\nset ylabel 'speedup'\nset key left top\nset grid\n"
+             << "names = \"" << names << "\"\n"
+             << "plot for [n in names] '" << csv << "' every ::1 using 2:(strcol(1) eq n ? $6 : 1/0) with linespoints title n, \\\n"
+             << "     x with lines dashtype 2 title 'ideal'\n";
+        std::cout << "wrote " << csv << " and " << gp << "\n";
+    }
+
+    /**
+    * \brief Run all scenarios and terminate the job system of this thread count.
+    */
+    Coro<> run_point() {
+        auto scenarios = run_scenarios();
+        co_await scenarios;
+        vgjs::terminate();
+        co_return;
+    }
+
+    /**
+    * \brief Run all scenarios on a fresh job system for 1, 2, 4, ... threads up to the highest count.
+    *
+    * \returns the exit code.
+    */
+    int run_scaling() {
+        uint32_t max_threads = g_options.m_max_threads > 0 ? g_options.m_max_threads : std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<uint32_t> counts;
+        for (uint32_t t = 1; t < max_threads; t *= 2) counts.push_back(t);
+        counts.push_back(max_threads);
+
+        for (auto threads : counts) {
+            JobSystem system(threads);      //becomes the instance() until it is destroyed
+            schedule(run_point());
+            system.wait_for_termination();
+        }
+
+        print_scaling(std::cout);
+        write_scaling(g_options.m_out.empty() ? "scaling.csv" : g_options.m_out);
+        return 0;
+    }
+
+    /**
+    * \brief Parse the options, start the job system and run the benchmarks.
+    *
+    * Options: --threads N, --runs N, --scale N, --csv, --json, --no-header, --out file.
+    * With --scaling [--max-threads N], all scenarios run on a fresh job system for 1, 2, 4, ... threads,
+    * and the results are written to --out (default scaling.csv) together with a gnuplot script.
+    * Else the job system starts once with --threads threads. With --baseline file [--tolerance x] [--allow-missing], the
+    * medians are compared with a file written before with --json, and the exit code is 1 if a scenario got slower,
+    * or if a scenario of the baseline did not run. Even without a baseline, the exit code is 1 if check_retired() fails.
+    *
+    * \returns the exit code.
+    */
+    int run(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool value = i + 1 < argc;
+            if (arg == "--threads" && value) g_options.m_threads = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--runs" && value) g_options.m_runs = std::max((uint32_t)std::stoul(argv[++i]), 1u);
+            else if (arg == "--scale" && value) g_options.m_scale = std::max((uint32_t)std::stoul(argv[++i]), 1u);
+            else if (arg == "--out" && value) g_options.m_out = argv[++i];
+            else if (arg == "--csv") g_options.m_format = "csv";
+            else if (arg == "--json") g_options.m_format = "json";
+            else if (arg == "--no-header") g_options.m_header = false;
+            else if (arg == "--scaling") g_options.m_scaling = true;
+            else if (arg == "--max-threads" && value) g_options.m_max_threads = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--baseline" && value) g_options.m_baseline = argv[++i];
+            else if (arg == "--tolerance" && value) g_options.m_tolerance = std::stod(argv[++i]);
+            else if (arg == "--allow-missing") g_options.m_allow_missing = true;
+            else {
+                std::cerr << "unknown option " << arg << "\n";
+                return 1;
+            }
+        }
+
+        if (g_options.m_scaling) {
+            return run_scaling();
+        }
+
+        JobSystem::instance(g_options.m_threads);
+        schedule(run_all());
+        wait_for_termination();
+        return g_exit;
+    }
+
+}
+
+
+#if defined(VGJS_BENCH_MAIN)    //standalone executable, e.g. g++ -std=c++20 -O2 -DVGJS_BENCH_MAIN microbench.cpp -pthread
+
+int main(int argc, char* argv[]) {
+    return microbench::run(argc, argv);
+}
+
+#endif